@@ -0,0 +1,235 @@
+// Measures the cost of StateMachine::Handle, StateMachine::Process and the
+// transition types against hand-written switch and function-pointer dispatch.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include "harness.hpp"
+#include "vsm/queue.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Stay {};
+struct Step {};
+struct NestedStay {};
+struct NestedStep {};
+struct Unknown {};
+
+template <std::size_t N>
+constexpr auto NextIndex(std::size_t i) -> std::size_t {
+  return (i + 1) % N;
+}
+
+/// @brief A state of an N-state ring, every Step moves to the next state.
+template <std::size_t I, std::size_t N>
+struct RingState {
+  using Next = RingState<(I + 1) % N, N>;
+  using Branch =
+      vsm::Either<vsm::TransitionTo<Next>, vsm::TransitionTo<RingState>>;
+  using Nested = vsm::Maybe<Branch>;
+
+  static constexpr auto Name() { return "RingState"; }
+
+  void OnEnter() { ++entered; }
+  auto Process() -> vsm::DoNothing {
+    ++processed;
+    return {};
+  }
+  auto Handle(const Stay & /*event*/) -> vsm::DoNothing {
+    ++handled;
+    return {};
+  }
+  auto Handle(const Step & /*event*/) -> vsm::TransitionTo<Next> {
+    ++handled;
+    return {};
+  }
+  auto Handle(const NestedStay & /*event*/) -> Nested {
+    ++handled;
+    return vsm::DoNothing{};
+  }
+  auto Handle(const NestedStep & /*event*/) -> Nested {
+    ++handled;
+    return Branch{vsm::TransitionTo<Next>{}};
+  }
+
+  // Three counters rather than one: g++ 12 reports the last of 256 states
+  // passed by value in registers as used uninitialized.
+  std::uint64_t handled = 0;
+  std::uint64_t entered = 0;
+  std::uint64_t processed = 0;
+};
+
+/// @brief Same as RingState but without Process(), see detail::HasProcess.
+template <std::size_t I, std::size_t N>
+struct PassiveState {
+  using Next = PassiveState<(I + 1) % N, N>;
+
+  auto Handle(const Step & /*event*/) -> vsm::TransitionTo<Next> { return {}; }
+};
+
+template <template <std::size_t, std::size_t> class State, std::size_t N,
+          std::size_t... I>
+auto MakeMachine(std::index_sequence<I...> /*indices*/) {
+  return vsm::StateMachine<State<I, N>...>{State<I, N>{}...};
+}
+
+template <template <std::size_t, std::size_t> class State, std::size_t N>
+auto MakeMachine() {
+  return MakeMachine<State, N>(std::make_index_sequence<N>{});
+}
+
+/// @brief Hand-written baseline, a switch over the active state index.
+template <std::size_t N>
+struct SwitchMachine {
+  template <std::size_t... I>
+  void Step(std::index_sequence<I...> /*indices*/) {
+    // Expands to a chain of compares the compiler turns into a jump table.
+    (void)((state == I ? (++counters[I], state = NextIndex<N>(I), true)
+                       : false) ||
+           ...);
+  }
+
+  void Step() { Step(std::make_index_sequence<N>{}); }
+
+  std::size_t state = 0;
+  std::array<std::uint64_t, N> counters{};
+};
+
+/// @brief Hand-written baseline, an indexed table of function pointers.
+template <std::size_t N>
+struct TableMachine {
+  using Fn = void (*)(TableMachine &);
+
+  template <std::size_t I>
+  static void StepIn(TableMachine &machine) {
+    ++machine.counters[I];
+    machine.state = NextIndex<N>(I);
+  }
+
+  template <std::size_t... I>
+  static constexpr auto MakeTable(std::index_sequence<I...> /*indices*/) {
+    return std::array<Fn, N>{&StepIn<I>...};
+  }
+
+  void Step() {
+    static constexpr auto kTable = MakeTable(std::make_index_sequence<N>{});
+    kTable[state](*this);
+  }
+
+  std::size_t state = 0;
+  std::array<std::uint64_t, N> counters{};
+};
+
+template <std::size_t N>
+void RunSuite(bench::Runner &runner) {
+  const auto suffix = "/" + std::to_string(N);
+
+  runner.Run("baseline_switch" + suffix, N, [](std::uint64_t events) {
+    SwitchMachine<N> machine;
+    for (std::uint64_t i = 0; i < events; ++i) {
+      machine.Step();
+    }
+    bench::DoNotOptimize(machine);
+  });
+
+  runner.Run("baseline_table" + suffix, N, [](std::uint64_t events) {
+    TableMachine<N> machine;
+    for (std::uint64_t i = 0; i < events; ++i) {
+      machine.Step();
+    }
+    bench::DoNotOptimize(machine);
+  });
+
+  auto machine = MakeMachine<RingState, N>();
+  auto passive = MakeMachine<PassiveState, N>();
+
+  auto run_event = [&runner, &machine, &suffix](const std::string &name,
+                                                 auto event) {
+    runner.Run(name + suffix, N, [&machine, &event](std::uint64_t events) {
+      for (std::uint64_t i = 0; i < events; ++i) {
+        machine.Handle(event);
+      }
+      bench::DoNotOptimize(machine);
+    });
+  };
+
+  run_event("handle_no_transition", Stay{});
+  run_event("handle_transition", Step{});
+  run_event("handle_nested_no_transition", NestedStay{});
+  run_event("handle_nested_transition", NestedStep{});
+  run_event("handle_unhandled", Unknown{});
+
+  constexpr std::size_t kBatch = 256;
+  auto run_batch = [&runner, &machine, &suffix](const std::string &name,
+                                                const auto &batch) {
+    runner.Run(name + suffix, N, [&machine, &batch](std::uint64_t events) {
+      for (std::uint64_t i = 0; i < events; i += batch.size()) {
+        machine.HandleBatch(batch.data(), batch.size());
+      }
+      bench::DoNotOptimize(machine);
+    });
+  };
+
+  std::array<Stay, kBatch> stay_batch{};
+  run_batch("handle_batch_no_transition", stay_batch);
+
+  std::array<std::variant<Stay, Step>, kBatch> mixed_batch{};
+  mixed_batch.back() = Step{};
+  run_batch("handle_batch_variant", mixed_batch);
+
+  std::uint64_t log_calls = 0;
+  machine.SetLogCallback([&log_calls](std::string_view /*from*/,
+                                      std::string_view /*to*/) {
+    ++log_calls;
+  });
+  run_event("handle_transition_log_callback", Step{});
+  bench::DoNotOptimize(log_calls);
+  machine.SetLogCallback(nullptr);
+
+  vsm::Queued<decltype(machine), kBatch, Stay, Step> queued{machine};
+  runner.Run("queued_post_drain" + suffix, N, [&queued](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; i += kBatch) {
+      for (std::size_t j = 0; j < kBatch; ++j) {
+        queued.Post(Stay{});
+      }
+      queued.Drain();
+    }
+    bench::DoNotOptimize(queued);
+  });
+
+  runner.Run("process_has_process" + suffix, N,
+             [&machine](std::uint64_t events) {
+               for (std::uint64_t i = 0; i < events; ++i) {
+                 machine.Process();
+               }
+               bench::DoNotOptimize(machine);
+             });
+
+  runner.Run("process_no_process" + suffix, N,
+             [&passive](std::uint64_t events) {
+               for (std::uint64_t i = 0; i < events; ++i) {
+                 passive.Process();
+               }
+               bench::DoNotOptimize(passive);
+             });
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+
+  RunSuite<2>(runner);
+  RunSuite<16>(runner);
+  RunSuite<64>(runner);
+  RunSuite<256>(runner);
+
+  runner.Report(std::cout);
+  return 0;
+}
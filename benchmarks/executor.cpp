@@ -0,0 +1,115 @@
+// Measures how a ShardedExecutor scales from 1 to N threads on a fleet of
+// pooled machines. Reports throughput per instance step and the p99 latency
+// of a whole tick.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "harness.hpp"
+#include "vsm/executor.hpp"
+#include "vsm/pool.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Kick {};
+
+struct Idle;
+struct Busy;
+
+struct Idle {
+  auto Process() -> vsm::Maybe<vsm::TransitionTo<Busy>> {
+    if (++ticks < 4) {
+      return vsm::DoNothing{};
+    }
+    ticks = 0;
+    return vsm::TransitionTo<Busy>{};
+  }
+  auto Handle(const Kick & /*event*/) -> vsm::TransitionTo<Busy> {
+    return {};
+  }
+
+  std::uint32_t ticks = 0;
+};
+
+struct Busy {
+  auto Process() -> vsm::Maybe<vsm::TransitionTo<Idle>> {
+    work = work * 6364136223846793005ULL + 1442695040888963407ULL;
+    if (work % 8 != 0) {
+      return vsm::DoNothing{};
+    }
+    return vsm::TransitionTo<Idle>{};
+  }
+
+  std::uint64_t work = 1;
+};
+
+using Pool = vsm::StateMachinePool<Idle, Busy>;
+using Executor = vsm::ShardedExecutor<Pool, 1024, Kick>;
+
+constexpr std::size_t kInstances = 1'000'000;
+constexpr std::size_t kShards = 256;
+
+void Measure(bench::Runner &runner, std::size_t threads) {
+  Executor executor{kShards, threads};
+  for (std::size_t i = 0; i < kInstances; ++i) {
+    executor.Add(Idle{}, Busy{});
+  }
+
+  const auto ticks =
+      std::max<std::uint64_t>(1, runner.GetOptions().events / kInstances);
+  std::vector<double> latencies;
+  latencies.reserve(ticks * runner.GetOptions().repetitions);
+  double best_ns = 0.0;
+  for (int rep = 0; rep < runner.GetOptions().repetitions; ++rep) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t tick = 0; tick < ticks; ++tick) {
+      for (std::size_t i = 0; i < kShards; ++i) {
+        executor.Post(i * 7919 % kInstances, Kick{});
+      }
+      const auto tick_start = std::chrono::steady_clock::now();
+      executor.Tick();
+      const auto tick_stop = std::chrono::steady_clock::now();
+      latencies.push_back(
+          std::chrono::duration<double, std::nano>(tick_stop - tick_start)
+              .count());
+    }
+    const auto stop = std::chrono::steady_clock::now();
+    const auto ns = std::chrono::duration<double, std::nano>(stop - start)
+                        .count() /
+                    static_cast<double>(ticks * kInstances);
+    best_ns = rep == 0 ? ns : std::min(best_ns, ns);
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  bench::Result result;
+  result.name = "executor_tick/" + std::to_string(threads);
+  result.states = 2;
+  result.events = ticks * kInstances;
+  result.ns_per_event = best_ns;
+  result.p99_ns = latencies[latencies.size() * 99 / 100];
+  runner.Add(std::move(result));
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+
+  const auto cores =
+      std::max<std::size_t>(1, std::thread::hardware_concurrency());
+  for (std::size_t threads = 1; threads < cores; threads *= 2) {
+    Measure(runner, threads);
+  }
+  Measure(runner, cores);
+
+  runner.Report(std::cout);
+  return 0;
+}
@@ -0,0 +1,240 @@
+#ifndef VSM_BENCHMARKS_HARNESS_HPP_
+#define VSM_BENCHMARKS_HARNESS_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+/// @brief Prevents the compiler from optimizing away a value.
+template <typename T>
+inline void DoNotOptimize(T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : "+m"(value) : : "memory");
+#else
+  static volatile auto sink = value;
+  sink = value;
+#endif
+}
+
+/// @brief Counts retired user-space instructions of the calling thread using
+/// perf_event_open. Unavailable outside of linux or when the kernel denies
+/// access (e.g. perf_event_paranoid, containers), in which case no counts are
+/// reported.
+class InstructionCounter {
+ public:
+  InstructionCounter() {
+#if defined(__linux__)
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+
+  InstructionCounter(const InstructionCounter &) = delete;
+  auto operator=(const InstructionCounter &) -> InstructionCounter & = delete;
+
+  ~InstructionCounter() {
+#if defined(__linux__)
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  [[nodiscard]] auto Available() const -> bool { return fd_ >= 0; }
+
+  void Start() {
+#if defined(__linux__)
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  auto Stop() -> std::optional<std::uint64_t> {
+#if defined(__linux__)
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      std::uint64_t count = 0;
+      if (read(fd_, &count, sizeof(count)) == sizeof(count)) {
+        return count;
+      }
+    }
+#endif
+    return std::nullopt;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+/// @brief A single measurement, normalized per event.
+struct Result {
+  std::string name;
+  std::size_t states = 0;
+  std::uint64_t events = 0;
+  double ns_per_event = 0.0;
+  std::optional<double> instructions_per_event;
+  std::optional<double> p99_ns;  ///< tail latency of one step, if measured
+};
+
+/// @brief Options shared by all benchmark executables.
+struct Options {
+  std::uint64_t events = 1'000'000;
+  int repetitions = 5;
+  bool csv = false;
+  std::string filter;
+};
+
+/// @brief Parses --events=N, --repetitions=N, --format=json|csv and
+/// --filter=substring.
+inline auto ParseOptions(int argc, char **argv) -> Options {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    auto value = [&arg](std::string_view key) -> std::optional<std::string> {
+      if (arg.substr(0, key.size()) == key) {
+        return std::string{arg.substr(key.size())};
+      }
+      return std::nullopt;
+    };
+    if (auto v = value("--events=")) {
+      options.events = std::stoull(*v);
+    } else if (auto v = value("--repetitions=")) {
+      options.repetitions = std::max(1, std::stoi(*v));
+    } else if (auto v = value("--format=")) {
+      options.csv = (*v == "csv");
+    } else if (auto v = value("--filter=")) {
+      options.filter = *v;
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--events=N] [--repetitions=N] [--format=json|csv]"
+                   " [--filter=substring]\n";
+      std::exit(2);
+    }
+  }
+  return options;
+}
+
+/// @brief Runs benchmarks and collects their results.
+class Runner {
+ public:
+  explicit Runner(Options options) : options_{std::move(options)} {}
+
+  [[nodiscard]] auto GetOptions() const -> const Options & { return options_; }
+
+  /// @brief The results collected so far.
+  [[nodiscard]] auto GetResults() const -> const std::vector<Result> & {
+    return results_;
+  }
+
+  /// @brief Measures `body(events)`, which must dispatch exactly `events`
+  /// events. The fastest of all repetitions is reported.
+  template <typename Body>
+  void Run(std::string name, std::size_t states, Body &&body) {
+    if (name.find(options_.filter) == std::string::npos) {
+      return;
+    }
+    const auto events = options_.events;
+    body(events / 10 + 1);  // warm up caches and branch predictors
+
+    double best_ns = std::numeric_limits<double>::max();
+    std::optional<double> best_instructions;
+    for (int rep = 0; rep < options_.repetitions; ++rep) {
+      counter_.Start();
+      const auto start = std::chrono::steady_clock::now();
+      body(events);
+      const auto stop = std::chrono::steady_clock::now();
+      const auto instructions = counter_.Stop();
+
+      const auto ns = std::chrono::duration<double, std::nano>(stop - start);
+      best_ns = std::min(best_ns, ns.count() / static_cast<double>(events));
+      if (instructions) {
+        const auto per_event =
+            static_cast<double>(*instructions) / static_cast<double>(events);
+        best_instructions = best_instructions
+                                ? std::min(*best_instructions, per_event)
+                                : per_event;
+      }
+    }
+    results_.push_back(Result{std::move(name), states, events, best_ns,
+                              best_instructions, std::nullopt});
+  }
+
+  /// @brief Adds an externally measured result.
+  void Add(Result result) {
+    if (result.name.find(options_.filter) != std::string::npos) {
+      results_.push_back(std::move(result));
+    }
+  }
+
+  /// @brief Writes all results as a JSON array or CSV table.
+  void Report(std::ostream &out) const {
+    if (options_.csv) {
+      out << "name,states,events,ns_per_event,instructions_per_event,p99_ns\n";
+      for (const auto &r : results_) {
+        out << r.name << ',' << r.states << ',' << r.events << ','
+            << r.ns_per_event << ',';
+        if (r.instructions_per_event) {
+          out << *r.instructions_per_event;
+        }
+        out << ',';
+        if (r.p99_ns) {
+          out << *r.p99_ns;
+        }
+        out << '\n';
+      }
+      return;
+    }
+    out << "[\n";
+    for (std::size_t i = 0; i < results_.size(); ++i) {
+      const auto &r = results_[i];
+      out << "  {\"name\": \"" << r.name << "\", \"states\": " << r.states
+          << ", \"events\": " << r.events
+          << ", \"ns_per_event\": " << r.ns_per_event
+          << ", \"instructions_per_event\": ";
+      if (r.instructions_per_event) {
+        out << *r.instructions_per_event;
+      } else {
+        out << "null";
+      }
+      if (r.p99_ns) {
+        out << ", \"p99_ns\": " << *r.p99_ns;
+      }
+      out << (i + 1 < results_.size() ? "},\n" : "}\n");
+    }
+    out << "]\n";
+  }
+
+ private:
+  Options options_;
+  InstructionCounter counter_;
+  std::vector<Result> results_;
+};
+
+}  // namespace bench
+
+#endif
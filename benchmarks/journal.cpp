@@ -0,0 +1,94 @@
+// Measures journaling events with a write-ahead journal for several group
+// commit sizes. Every group costs one fdatasync, so the events per second
+// grow with the group until the writes dominate. They are printed to stderr
+// next to the report. The journal is written to the working directory, run
+// the benchmark on the file system that is to be measured.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "harness.hpp"
+#include "vsm/journal.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Order {
+  std::uint64_t id;
+  std::uint32_t quantity;
+};
+struct Fill {
+  std::uint64_t id;
+};
+
+struct Filled;
+
+struct Pending {
+  auto Handle(const Order &order) -> vsm::DoNothing {
+    volume += order.quantity;
+    return {};
+  }
+  auto Handle(const Fill & /* event */) -> vsm::TransitionTo<Filled> {
+    return {};
+  }
+  std::uint64_t volume = 0;
+};
+
+struct Filled {
+  auto Handle(const Order & /* event */) -> vsm::TransitionTo<Pending> {
+    return {};
+  }
+};
+
+using Book =
+    vsm::Journaled<vsm::StateMachine<Pending, Filled>, Order, Fill>;
+
+void Remove(const std::string &path) {
+  std::remove(path.c_str());
+  std::remove((path + ".snapshot").c_str());
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+  const std::string path = "vsm_journal_bench.log";
+
+  for (const std::size_t group : {1, 16, 256, 4096}) {
+    runner.Run("group_" + std::to_string(group), 2,
+               [&path, group](std::uint64_t n) {
+                 Remove(path);
+                 vsm::JournalOptions options;
+                 options.group_events = group;
+                 options.group_window = std::chrono::seconds{1};
+                 options.checkpoint_events = 0;
+                 auto book = Book::Open(path, options, Pending{}, Filled{});
+                 if (!book) {
+                   std::cerr << "could not open " << path << "\n";
+                   std::exit(1);
+                 }
+                 for (std::uint64_t i = 0; i < n; ++i) {
+                   if (i % 4 == 3) {
+                     book->Handle(Fill{i});
+                   } else {
+                     book->Handle(Order{i, static_cast<std::uint32_t>(i)});
+                   }
+                 }
+                 book->Commit();
+                 bench::DoNotOptimize(*book);
+               });
+  }
+
+  Remove(path);
+  runner.Report(std::cout);
+  for (const auto &result : runner.GetResults()) {
+    std::cerr << result.name << ": " << 1e9 / result.ns_per_event
+              << " events/s\n";
+  }
+  return 0;
+}
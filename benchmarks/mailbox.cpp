@@ -0,0 +1,106 @@
+// Measures the throughput of the MPSC Mailbox under contention from 1, 4, 16
+// and 64 producer threads against the SPSC Queued adapter. Instructions are
+// those of the draining thread only.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.hpp"
+#include "vsm/queue.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Ping {
+  std::uint64_t value = 0;
+};
+
+struct Pong {
+  std::uint64_t value = 0;
+};
+
+struct Idle;
+
+struct Busy {
+  auto Handle(const Ping &event) -> vsm::DoNothing {
+    sum += event.value;
+    return {};
+  }
+  auto Handle(const Pong & /*event*/) -> vsm::TransitionTo<Idle> { return {}; }
+
+  std::uint64_t sum = 0;
+};
+
+struct Idle {
+  auto Handle(const Ping & /*event*/) -> vsm::TransitionTo<Busy> { return {}; }
+  auto Handle(const Pong & /*event*/) -> vsm::DoNothing { return {}; }
+};
+
+constexpr std::size_t kCapacity = 1024;
+
+using Machine = vsm::StateMachine<Busy, Idle>;
+
+/// @brief Posts `events` events from `producers` threads and drains them on
+/// the calling thread.
+template <typename Adapter>
+void Contend(Adapter &adapter, std::size_t producers, std::uint64_t events) {
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+  threads.reserve(producers);
+  for (std::size_t p = 0; p < producers; ++p) {
+    const auto share = events / producers + (p < events % producers ? 1 : 0);
+    threads.emplace_back([&adapter, &go, share] {
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      for (std::uint64_t i = 0; i < share; ++i) {
+        while (!(i % 64 == 63 ? adapter.Post(Pong{i})
+                               : adapter.Post(Ping{i}))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  go.store(true, std::memory_order_release);
+  std::uint64_t drained = 0;
+  while (drained < events) {
+    const auto count = adapter.Drain();
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+    drained += count;
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+
+  vsm::Queued<Machine, kCapacity, Ping, Pong> spsc{Busy{}, Idle{}};
+  runner.Run("spsc/1", 2, [&spsc](std::uint64_t events) {
+    Contend(spsc, 1, events);
+    bench::DoNotOptimize(spsc);
+  });
+
+  vsm::Mailbox<Machine, kCapacity, vsm::Overflow::kSpin, Ping, Pong> mailbox{
+      Busy{}, Idle{}};
+  for (std::size_t producers : {1, 4, 16, 64}) {
+    runner.Run("mailbox_spin/" + std::to_string(producers), 2,
+               [&mailbox, producers](std::uint64_t events) {
+                 Contend(mailbox, producers, events);
+                 bench::DoNotOptimize(mailbox);
+               });
+  }
+
+  runner.Report(std::cout);
+  return 0;
+}
@@ -0,0 +1,108 @@
+// Measures processing a fleet of identical machines, stored as separate
+// StateMachine objects versus a StateMachinePool, processed per instance or
+// grouped by state.
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+#include "vsm/pool.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Tick {};
+
+struct Idle;
+struct Busy;
+struct Done;
+
+/// @brief Stays for a few Process() calls, then moves on.
+template <typename Next>
+struct Counting {
+  auto Process() -> vsm::Maybe<vsm::TransitionTo<Next>> {
+    if (++ticks < 8) {
+      return vsm::DoNothing{};
+    }
+    ticks = 0;
+    return vsm::TransitionTo<Next>{};
+  }
+  auto Handle(const Tick & /*event*/) -> vsm::DoNothing { return {}; }
+
+  std::uint32_t ticks = 0;
+};
+
+struct Idle : Counting<Busy> {};
+struct Busy : Counting<Done> {
+  std::uint64_t work = 0;
+};
+struct Done : Counting<Idle> {};
+
+constexpr std::size_t kInstances = 100'000;
+
+/// @brief Staggers the instances so neighbours are in different states.
+template <typename Step>
+void Stagger(Step &&step) {
+  for (std::size_t id = 0; id < kInstances; ++id) {
+    for (std::size_t i = 0; i < id % 24; ++i) {
+      step(id);
+    }
+  }
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+  const auto suffix = "/" + std::to_string(kInstances);
+
+  std::vector<vsm::StateMachine<Idle, Busy, Done>> machines;
+  machines.reserve(kInstances);
+  for (std::size_t id = 0; id < kInstances; ++id) {
+    machines.emplace_back(Idle{}, Busy{}, Done{});
+  }
+  Stagger([&machines](std::size_t id) { machines[id].Process(); });
+
+  runner.Run("machines_process_all" + suffix, 3,
+             [&machines](std::uint64_t events) {
+               for (std::uint64_t i = 0; i < events; i += kInstances) {
+                 for (auto &machine : machines) {
+                   machine.Process();
+                 }
+               }
+               bench::DoNotOptimize(machines);
+             });
+
+  vsm::StateMachinePool<Idle, Busy, Done> pool{kInstances, Idle{}, Busy{},
+                                               Done{}};
+  Stagger([&pool](std::size_t id) { pool.Process(id); });
+
+  runner.Run("pool_process_all" + suffix, 3, [&pool](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; i += kInstances) {
+      pool.ProcessAll();
+    }
+    bench::DoNotOptimize(pool);
+  });
+
+  runner.Run("pool_process_each" + suffix, 3, [&pool](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; i += kInstances) {
+      for (std::size_t id = 0; id < kInstances; ++id) {
+        pool.Process(id);
+      }
+    }
+    bench::DoNotOptimize(pool);
+  });
+
+  runner.Run("pool_handle" + suffix, 3, [&pool](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; ++i) {
+      pool.Handle(i % kInstances, Tick{});
+    }
+    bench::DoNotOptimize(pool);
+  });
+
+  runner.Report(std::cout);
+  return 0;
+}
@@ -0,0 +1,87 @@
+// Measures fanning events out to two independent aspects of a device, kept
+// as two separate StateMachine objects versus one OrthogonalStateMachine with
+// two regions.
+
+#include <cstdint>
+#include <iostream>
+
+#include "harness.hpp"
+#include "vsm/regions.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Toggle {};
+struct LinkOnly {};
+
+struct LinkDown;
+struct Standby;
+
+struct LinkUp {
+  auto Handle(const Toggle & /*event*/) -> vsm::TransitionTo<LinkDown> {
+    return {};
+  }
+  auto Handle(const LinkOnly & /*event*/) -> vsm::DoNothing { return {}; }
+};
+
+struct LinkDown {
+  auto Handle(const Toggle & /*event*/) -> vsm::TransitionTo<LinkUp> {
+    return {};
+  }
+  auto Handle(const LinkOnly & /*event*/) -> vsm::DoNothing { return {}; }
+};
+
+struct Active {
+  auto Handle(const Toggle & /*event*/) -> vsm::TransitionTo<Standby> {
+    return {};
+  }
+};
+
+struct Standby {
+  auto Handle(const Toggle & /*event*/) -> vsm::TransitionTo<Active> {
+    return {};
+  }
+};
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+
+  vsm::StateMachine link{LinkDown{}, LinkUp{}};
+  vsm::StateMachine power{Active{}, Standby{}};
+  auto separate = [&link, &power](const auto &event) {
+    link.Handle(event);
+    power.Handle(event);
+  };
+
+  runner.Run("separate_machines_both", 4, [&separate](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; ++i) {
+      separate(Toggle{});
+    }
+  });
+  runner.Run("separate_machines_one", 4, [&separate](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; ++i) {
+      separate(LinkOnly{});
+    }
+  });
+
+  vsm::OrthogonalStateMachine regions{vsm::Region{LinkDown{}, LinkUp{}},
+                                      vsm::Region{Active{}, Standby{}}};
+
+  runner.Run("regions_both", 4, [&regions](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; ++i) {
+      regions.Handle(Toggle{});
+    }
+    bench::DoNotOptimize(regions);
+  });
+  runner.Run("regions_one", 4, [&regions](std::uint64_t events) {
+    for (std::uint64_t i = 0; i < events; ++i) {
+      regions.Handle(LinkOnly{});
+    }
+    bench::DoNotOptimize(regions);
+  });
+
+  runner.Report(std::cout);
+  return 0;
+}
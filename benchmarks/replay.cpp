@@ -0,0 +1,112 @@
+// Measures recording events into a binary event log and replaying the log
+// into a fresh machine. The log is captured from synthetic traffic here, a
+// log captured in production is replayed the same way by an
+// EventLogReplayer over the application's events and machine.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "harness.hpp"
+#include "vsm/replay.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+struct Order {
+  std::uint64_t id;
+  std::uint32_t quantity;
+};
+struct Cancel {
+  std::uint64_t id;
+};
+struct Halt {};
+
+struct Halted;
+
+struct Trading {
+  auto Handle(const Order &order) -> vsm::DoNothing {
+    volume += order.quantity;
+    return {};
+  }
+  auto Handle(const Cancel & /* event */) -> vsm::DoNothing {
+    cancels++;
+    return {};
+  }
+  auto Handle(const Halt & /* event */) -> vsm::TransitionTo<Halted> {
+    return {};
+  }
+  std::uint64_t volume = 0;
+  std::uint64_t cancels = 0;
+};
+
+struct Halted {
+  auto Handle(const Halt & /* event */) -> vsm::TransitionTo<Trading> {
+    return {};
+  }
+};
+
+using Exchange = vsm::StateMachine<Trading, Halted>;
+using Recorder = vsm::Recorded<Exchange, Order, Cancel, Halt>;
+using Replayer = vsm::EventLogReplayer<Order, Cancel, Halt>;
+
+/// @brief Mostly orders, some cancels and a rare halt or resume.
+template <typename Machine>
+void Traffic(Machine &machine, std::uint64_t events) {
+  for (std::uint64_t i = 0; i < events; ++i) {
+    if (i % 1000 == 999) {
+      machine.Handle(Halt{});
+    } else if (i % 8 == 7) {
+      machine.Handle(Cancel{i});
+    } else {
+      machine.Handle(Order{i, static_cast<std::uint32_t>(i % 100)});
+    }
+  }
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+  const std::string path = "vsm_replay_bench.log";
+  const auto events = runner.GetOptions().events;
+
+  runner.Run("record", 2, [&path](std::uint64_t n) {
+    std::ofstream log{path, std::ios::binary};
+    Recorder sm{log, Trading{}, Halted{}};
+    Traffic(sm, n);
+    bench::DoNotOptimize(sm);
+  });
+
+  {
+    std::ofstream log{path, std::ios::binary};
+    Recorder sm{log, Trading{}, Halted{}};
+    Traffic(sm, events);
+  }
+  auto replayer = Replayer::Open(path.c_str());
+  if (!replayer) {
+    std::cerr << "could not open " << path << "\n";
+    return 1;
+  }
+
+  runner.Run("handle", 2, [](std::uint64_t n) {
+    Exchange sm{Trading{}, Halted{}};
+    Traffic(sm, n);
+    bench::DoNotOptimize(sm);
+  });
+
+  runner.Run("replay", 2, [&replayer](std::uint64_t n) {
+    Exchange sm{Trading{}, Halted{}};
+    for (std::uint64_t replayed = 0; replayed < n;) {
+      replayed += replayer->Replay(sm, 0, n - replayed);
+    }
+    bench::DoNotOptimize(sm);
+  });
+
+  std::remove(path.c_str());
+  runner.Report(std::cout);
+  return 0;
+}
@@ -0,0 +1,132 @@
+// Measures timeouts of a fleet of machines, delivered by a TimerWheel versus
+// counted down by calling Process() on every machine every tick, and the
+// cost of re-arming a timer in a wheel holding many. Every machine times out
+// once per kPeriod ticks, the fleet is staggered so the same number of
+// timeouts is due in every tick.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+#include "vsm/timer.hpp"
+#include "vsm/vsm.hpp"
+
+namespace {
+
+using Clock = vsm::TimerWheel::Clock;
+
+constexpr std::size_t kMachines = 65'536;
+constexpr std::uint32_t kPeriod = 64;
+constexpr std::size_t kPerTick = kMachines / kPeriod;
+constexpr std::chrono::milliseconds kTick{1};
+
+struct Dark;
+
+struct Lit : vsm::Timeouts<Lit> {
+  Lit(vsm::TimerWheel &wheel, std::uint32_t first)
+      : Timeouts{wheel}, delay{first} {}
+  void OnEnter() {
+    ArmTimeout<Lit>(delay * kTick);
+    delay = kPeriod;
+  }
+  auto Handle(const vsm::Timeout<Lit> & /*event*/)
+      -> vsm::TransitionTo<Dark> {
+    return {};
+  }
+  std::uint32_t delay;
+};
+
+struct Dark : vsm::Timeouts<Dark> {
+  using Timeouts::Timeouts;
+  void OnEnter() { ArmTimeout<Dark>(kPeriod * kTick); }
+  auto Handle(const vsm::Timeout<Dark> & /*event*/) -> vsm::TransitionTo<Lit> {
+    return {};
+  }
+};
+
+using Blinker = vsm::StateMachine<Lit, Dark>;
+
+/// @brief Counts its own ticks like a state polled from a fixed loop.
+template <typename Next>
+struct Polled {
+  auto Process() -> vsm::Maybe<vsm::TransitionTo<Next>> {
+    if (++ticks < kPeriod) {
+      return vsm::DoNothing{};
+    }
+    ticks = 0;
+    return vsm::TransitionTo<Next>{};
+  }
+  std::uint32_t ticks = 0;
+};
+
+struct PolledDark;
+struct PolledLit : Polled<PolledDark> {};
+struct PolledDark : Polled<PolledLit> {};
+
+using PolledBlinker = vsm::StateMachine<PolledLit, PolledDark>;
+
+/// @brief Ticks needed for at least `events` timeouts.
+auto TicksFor(std::uint64_t events) -> std::uint64_t {
+  return (events + kPerTick - 1) / kPerTick;
+}
+
+}  // namespace
+
+auto main(int argc, char **argv) -> int {
+  bench::Runner runner{bench::ParseOptions(argc, argv)};
+  const auto suffix = "/" + std::to_string(kMachines);
+
+  {
+    const auto start = Clock::now();
+    vsm::TimerWheel wheel{kTick, start};
+    // Reserved up front, the machines must not move once armed.
+    std::vector<Blinker> fleet;
+    fleet.reserve(kMachines);
+    for (std::size_t id = 0; id < kMachines; ++id) {
+      const auto first = static_cast<std::uint32_t>(id % kPeriod + 1);
+      fleet.emplace_back(Lit{wheel, first}, Dark{wheel}).InitialTransition();
+    }
+    std::uint64_t tick = 0;
+    runner.Run("wheel" + suffix, 2, [&](std::uint64_t n) {
+      for (auto end = tick + TicksFor(n); tick < end;) {
+        wheel.Advance(start + ++tick * kTick);
+      }
+    });
+  }
+
+  {
+    std::vector<PolledBlinker> fleet(kMachines,
+                                     PolledBlinker{PolledLit{}, PolledDark{}});
+    for (std::size_t id = 0; id < kMachines; ++id) {
+      fleet[id].GetState<PolledLit>().ticks =
+          static_cast<std::uint32_t>(kPeriod - 1 - id % kPeriod);
+    }
+    runner.Run("poll" + suffix, 2, [&](std::uint64_t n) {
+      for (auto ticks = TicksFor(n); ticks > 0; --ticks) {
+        for (auto &sm : fleet) {
+          sm.Process();
+        }
+      }
+    });
+  }
+
+  {
+    vsm::TimerWheel wheel{kTick};
+    std::vector<vsm::Timer> timers(kMachines);
+    for (std::size_t i = 0; i < timers.size(); ++i) {
+      wheel.Arm(timers[i], (i * 7919 % 100'000) * kTick);
+    }
+    runner.Run("rearm" + suffix, 1, [&](std::uint64_t n) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        wheel.Arm(timers[i % kMachines], (i * 7919 % 100'000 + 1) * kTick);
+      }
+    });
+  }
+
+  runner.Report(std::cout);
+  return 0;
+}
@@ -1,21 +1,34 @@
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
 
 #include "states.hpp"
+#include "vsm/queue.hpp"
+#include "vsm/timer.hpp"
 #include "vsm/vsm.hpp"
 
 namespace {
 
-char input = '\0';
+using TrafficLights = vsm::Queued<vsm::StateMachine<Red, Yellow, Green>, 16,
+                                  ButtonPushed, Ambulance>;
 
-void GetInput() {
-  while (true) {
-    std::cin >> input;
+std::atomic<bool> quit{false};
+
+void GetInput(TrafficLights &sm) {
+  char input = '\0';
+  while (std::cin >> input) {
+    if (input == 'p') {
+      sm.Post(ButtonPushed{});
+    }
+    if (input == 'a') {
+      sm.Post(Ambulance{});
+    }
     if (input == 'q') {
       break;
     }
   }
+  quit = true;
 }
 
 }  // namespace
@@ -24,24 +37,18 @@ auto main() -> int {
   std::cout << "Press 'p' to cause a transition to green, 'a' to cause a "
                "transition to red\n";
 
-  std::thread input_thread(GetInput);
-
   Data data;
-  vsm::StateMachine sm(Red{data}, Yellow{data}, Green{data});
+  vsm::TimerWheel wheel{std::chrono::milliseconds{10}};
+  TrafficLights sm(Red{data, wheel}, Yellow{data, wheel}, Green{data, wheel});
 
   sm.InitialTransition();
 
-  while (input != 'q') {
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    sm.Process();
-    if (input == 'p') {
-      input = '\0';
-      sm.Handle(ButtonPushed{});
-    }
-    if (input == 'a') {
-      input = '\0';
-      sm.Handle(Ambulance{});
-    }
+  std::thread input_thread(GetInput, std::ref(sm));
+
+  while (!quit) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    wheel.Advance(vsm::TimerWheel::Clock::now());
+    sm.Drain();
   }
 
   input_thread.join();
@@ -1,5 +1,7 @@
 #include "states.hpp"
 
+#include <chrono>
+
 namespace {
 constexpr const char* kRed =
     "\033[31m\u2B24\033[0m "
@@ -17,17 +19,13 @@ constexpr const char* kGreen =
 
 void Red::OnEnter() {
   std::cout << kRed;
-  data_.timer = 0;
   data_.to_green = true;
+  ArmTimeout<Red>(std::chrono::seconds{3});
 };
 
-auto Red::Process() -> vsm::Maybe<vsm::TransitionTo<Yellow>> {
-  data_.timer++;
-  if (data_.timer > 5) {
-    return vsm::TransitionTo<Yellow>{};
-  } else {
-    return vsm::DoNothing{};
-  }
+auto Red::Handle(const vsm::Timeout<Red>& /*event*/)
+    -> vsm::TransitionTo<Yellow> {
+  return {};
 }
 
 void Red::OnExit() { std::cout << "  \u2B9F  \n"; };
@@ -37,54 +35,35 @@ auto Red::Handle(const ButtonPushed& /*event*/) -> vsm::TransitionTo<Yellow> {
   return {};
 }
 
-auto Red::Handle(const Ambulance&) -> vsm::DoNothing {
-  return vsm::DoNothing{};
-}
-
 void Yellow::OnEnter() {
   std::cout << kYellow;
-  data_.timer = 0;
+  ArmTimeout<Yellow>(std::chrono::milliseconds{1500});
 };
 
-auto Yellow::Process()
-    -> vsm::Maybe<vsm::TransitionTo<Red>, vsm::TransitionTo<Green>> {
-  data_.timer++;
-  if (data_.timer > 2) {
-    if (data_.to_green) {
-      return vsm::TransitionTo<Green>{};
-    } else {
-      return vsm::TransitionTo<Red>{};
-    }
+auto Yellow::Handle(const vsm::Timeout<Yellow>& /*event*/)
+    -> vsm::Either<vsm::TransitionTo<Red>, vsm::TransitionTo<Green>> {
+  if (data_.to_green) {
+    return vsm::TransitionTo<Green>{};
   } else {
-    return vsm::DoNothing{};
+    return vsm::TransitionTo<Red>{};
   }
 }
 
 void Yellow::OnExit() { std::cout << "  \u2B9F  \n"; };
 
-auto Yellow::Handle(const ButtonPushed&) -> vsm::DoNothing { return {}; }
-
-auto Yellow::Handle(const Ambulance&) -> vsm::DoNothing { return {}; }
-
 void Green::OnEnter() {
   std::cout << kGreen;
-  data_.timer = 0;
   data_.to_green = false;
+  ArmTimeout<Green>(std::chrono::seconds{3});
 };
 
-auto Green::Process() -> vsm::Maybe<vsm::TransitionTo<Yellow>> {
-  data_.timer++;
-  if (data_.timer > 5) {
-    return vsm::TransitionTo<Yellow>{};
-  } else {
-    return vsm::DoNothing{};
-  }
+auto Green::Handle(const vsm::Timeout<Green>& /*event*/)
+    -> vsm::TransitionTo<Yellow> {
+  return {};
 }
 
 void Green::OnExit() { std::cout << "  \u2B9F  \n"; };
 
-auto Green::Handle(const ButtonPushed&) -> vsm::DoNothing { return {}; }
-
 auto Green::Handle(const Ambulance&) -> vsm::TransitionTo<Yellow> {
   std::cout << "[Event] Ambulance\n";
   return {};
@@ -3,6 +3,7 @@
 
 #include <iostream>
 
+#include "vsm/timer.hpp"
 #include "vsm/vsm.hpp"
 
 //////////////////////////////////
@@ -18,7 +19,6 @@ struct ButtonPushed {};
 //////////////////////////////////
 
 struct Data {
-  int timer = 0;
   bool to_green = true;
 };
 
@@ -29,41 +29,38 @@ struct Data {
 struct Yellow;
 struct Green;
 
-struct Red {
-  explicit Red(Data& data) : data_{data} {}
+struct Red : vsm::Timeouts<Red> {
+  Red(Data& data, vsm::TimerWheel& wheel) : Timeouts{wheel}, data_{data} {}
 
   void OnEnter();
-  auto Process() -> vsm::Maybe<vsm::TransitionTo<Yellow>>;
   void OnExit();
 
+  auto Handle(const vsm::Timeout<Red>&) -> vsm::TransitionTo<Yellow>;
   auto Handle(const ButtonPushed& event) -> vsm::TransitionTo<Yellow>;
-  auto Handle(const Ambulance&) -> vsm::DoNothing;
 
   Data& data_;
 };
 
-struct Yellow {
-  explicit Yellow(Data& data) : data_{data} {}
+struct Yellow : vsm::Timeouts<Yellow> {
+  Yellow(Data& data, vsm::TimerWheel& wheel)
+      : Timeouts{wheel}, data_{data} {}
 
   void OnEnter();
-  auto Process()
-      -> vsm::Maybe<vsm::TransitionTo<Red>, vsm::TransitionTo<Green>>;
   void OnExit();
 
-  auto Handle(const ButtonPushed& event) -> vsm::DoNothing;
-  auto Handle(const Ambulance&) -> vsm::DoNothing;
+  auto Handle(const vsm::Timeout<Yellow>&)
+      -> vsm::Either<vsm::TransitionTo<Red>, vsm::TransitionTo<Green>>;
 
   Data& data_;
 };
 
-struct Green {
-  explicit Green(Data& data) : data_{data} {}
+struct Green : vsm::Timeouts<Green> {
+  Green(Data& data, vsm::TimerWheel& wheel) : Timeouts{wheel}, data_{data} {}
 
   void OnEnter();
-  auto Process() -> vsm::Maybe<vsm::TransitionTo<Yellow>>;
   void OnExit();
 
-  auto Handle(const ButtonPushed& event) -> vsm::DoNothing;
+  auto Handle(const vsm::Timeout<Green>&) -> vsm::TransitionTo<Yellow>;
   auto Handle(const Ambulance&) -> vsm::TransitionTo<Yellow>;
 
   Data& data_;
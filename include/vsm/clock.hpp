@@ -0,0 +1,78 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_CLOCK_H_
+#define VARIADICSTATEMACHINE_CLOCK_H_
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(VSM_USE_TSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+namespace vsm {
+
+/// @brief Cheap timestamps for tracing and latency measurements. Uses the
+/// time stamp counter if VSM_USE_TSC is defined on x86,
+/// std::chrono::steady_clock in nanoseconds otherwise.
+struct TickClock {
+  [[nodiscard]] static auto Now() -> std::uint64_t {
+#if defined(VSM_USE_TSC) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+#endif
+  }
+
+  /// @brief Ticks per microsecond, the time stamp counter is calibrated
+  /// against steady_clock once.
+  [[nodiscard]] static auto TicksPerMicrosecond() -> double;
+};
+
+// =======================================================================
+// Implementation of TickClock Class
+// =======================================================================
+
+inline auto TickClock::TicksPerMicrosecond() -> double {
+#if defined(VSM_USE_TSC) && (defined(__x86_64__) || defined(__i386__))
+  static const double kTicks = [] {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    const auto first = Now();
+    while (Clock::now() - start < std::chrono::milliseconds{10}) {
+    }
+    const auto ticks = Now() - first;
+    const auto elapsed =
+        std::chrono::duration<double, std::micro>(Clock::now() - start);
+    return static_cast<double>(ticks) / elapsed.count();
+  }();
+  return kTicks;
+#else
+  return 1000.0;
+#endif
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,238 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#ifndef VARIADICSTATEMACHINE_EXECUTOR_H_
+#define VARIADICSTATEMACHINE_EXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "vsm/queue.hpp"
+
+namespace vsm {
+
+/// @brief Spreads the instances of a fleet over shards, each a pool of its
+/// own with an event mailbox, and processes them on several threads. An
+/// instance stays on its shard, so its state data is never locked. Every
+/// worker owns some shards and steals whole shards from the others once it
+/// ran out of own work.
+/// @tparam Pool      The per-shard pool, e.g. vsm::StateMachinePool<...>
+/// @tparam Capacity  The number of queued events per shard, a power of two
+/// @tparam ...Events The event types that can be posted
+template <typename Pool, std::size_t Capacity, typename... Events>
+class ShardedExecutor {
+ public:
+  using Id = std::size_t;
+
+  /// @brief Constructs `shards` empty shards processed by `threads` threads,
+  /// the calling thread being one of them.
+  ShardedExecutor(std::size_t shards, std::size_t threads);
+  ShardedExecutor(const ShardedExecutor &) = delete;
+  auto operator=(const ShardedExecutor &) -> ShardedExecutor & = delete;
+  ~ShardedExecutor();
+
+  /// @brief Adds an instance, the shards are filled round-robin.
+  /// Note: Not thread-safe, call before the first Tick().
+  /// @return The id of the new instance
+  template <typename... States>
+  auto Add(States &&...states) -> Id;
+
+  /// @brief Queues an event for the instance `id`, callable from any thread.
+  /// It is handled at the beginning of the next Tick().
+  /// @return false if the shard's mailbox is full and the event was dropped
+  template <typename Event>
+  auto Post(Id id, Event &&event) -> bool;
+
+  /// @brief Handles all queued events and processes every instance once,
+  /// returns after all shards are done.
+  void Tick();
+
+  /// @brief Checks if the instance `id` is currently in a specific state.
+  /// Note: Only valid between calls to Tick().
+  template <typename State>
+  [[nodiscard]] auto IsInState(Id id) -> bool {
+    return shards_[id % shards_.size()]->pool.template IsInState<State>(
+        id / shards_.size());
+  }
+
+  /// @brief The number of instances.
+  [[nodiscard]] auto Size() const -> std::size_t { return size_; }
+
+ private:
+  struct Envelope {
+    template <typename Event>
+    Envelope(Id local_id, Event &&e)
+        : id{local_id}, event{std::forward<Event>(e)} {}
+
+    Id id;
+    std::variant<Events...> event;
+  };
+
+  struct alignas(kCacheLineSize) Shard {
+    Pool pool;
+    MpscQueue<Envelope, Capacity> mailbox;
+    /// @brief The last tick this shard was claimed for
+    std::atomic<std::uint64_t> tick{0};
+  };
+
+  /// @brief Claims and runs shards of `tick`, own shards first.
+  void Work(std::size_t worker, std::uint64_t tick);
+
+  /// @brief Runs the shard `index` if nobody claimed it for `tick` yet.
+  void TryRun(std::size_t index, std::uint64_t tick);
+
+  void RunWorker(std::size_t worker);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::vector<std::thread> workers_;
+  std::size_t size_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::uint64_t tick_ = 0;
+  bool stop_ = false;
+  std::atomic<std::size_t> pending_{0};
+};
+
+// =======================================================================
+// Implementation of ShardedExecutor Class
+// =======================================================================
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+ShardedExecutor<Pool, Capacity, Events...>::ShardedExecutor(
+    std::size_t shards, std::size_t threads) {
+  shards_.reserve(shards);
+  for (std::size_t i = 0; i < shards; ++i) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+  for (std::size_t worker = 1; worker < threads; ++worker) {
+    workers_.emplace_back([this, worker] { RunWorker(worker); });
+  }
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+ShardedExecutor<Pool, Capacity, Events...>::~ShardedExecutor() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+template <typename... States>
+auto ShardedExecutor<Pool, Capacity, Events...>::Add(States &&...states)
+    -> Id {
+  const auto shard = size_ % shards_.size();
+  const auto local = shards_[shard]->pool.Add(std::forward<States>(states)...);
+  ++size_;
+  return local * shards_.size() + shard;
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+template <typename Event>
+auto ShardedExecutor<Pool, Capacity, Events...>::Post(Id id, Event &&event)
+    -> bool {
+  return shards_[id % shards_.size()]->mailbox.TryEmplace(
+      id / shards_.size(), std::forward<Event>(event));
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+void ShardedExecutor<Pool, Capacity, Events...>::Tick() {
+  std::uint64_t tick = 0;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    tick = ++tick_;
+    pending_.store(shards_.size(), std::memory_order_relaxed);
+  }
+  start_.notify_all();
+  Work(0, tick);
+  while (pending_.load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+void ShardedExecutor<Pool, Capacity, Events...>::Work(std::size_t worker,
+                                                      std::uint64_t tick) {
+  const auto threads = workers_.size() + 1;
+  for (auto index = worker; index < shards_.size(); index += threads) {
+    TryRun(index, tick);
+  }
+  for (std::size_t i = 1; i < shards_.size(); ++i) {
+    TryRun((worker + i) % shards_.size(), tick);
+  }
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+void ShardedExecutor<Pool, Capacity, Events...>::TryRun(std::size_t index,
+                                                        std::uint64_t tick) {
+  auto &shard = *shards_[index];
+  auto previous = tick - 1;
+  if (!shard.tick.compare_exchange_strong(previous, tick,
+                                          std::memory_order_acquire)) {
+    return;
+  }
+  shard.mailbox.ConsumeAll(
+      [&shard](Envelope &&envelope) {
+        std::visit(
+            [&shard, &envelope](auto &event) {
+              shard.pool.Handle(envelope.id, event);
+            },
+            envelope.event);
+      },
+      Capacity);
+  shard.pool.ProcessAll();
+  pending_.fetch_sub(1, std::memory_order_release);
+}
+
+template <typename Pool, std::size_t Capacity, typename... Events>
+void ShardedExecutor<Pool, Capacity, Events...>::RunWorker(
+    std::size_t worker) {
+  std::uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      start_.wait(lock, [this, seen] { return stop_ || tick_ != seen; });
+      if (stop_) {
+        return;
+      }
+      seen = tick_;
+    }
+    Work(worker, seen);
+  }
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,540 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#ifndef VARIADICSTATEMACHINE_JOURNAL_H_
+#define VARIADICSTATEMACHINE_JOURNAL_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "vsm/replay.hpp"
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief How a Journaled machine commits its journal.
+struct JournalOptions {
+  /// @brief Records made durable together by a single fsync at most
+  std::size_t group_events = 1024;
+
+  /// @brief The longest a record waits for its group commit. Only checked
+  /// when a record is appended, call Commit() when the machine goes idle.
+  std::chrono::microseconds group_window{1000};
+
+  /// @brief Committed records after which the journal is compacted into a
+  /// snapshot of the machine, 0 never compacts automatically.
+  std::size_t checkpoint_events = std::size_t{1} << 20;
+};
+
+/// @brief Adapts a state machine to append every handled event and every
+/// Process() call to a write-ahead journal before the machine acts. Records
+/// are committed in groups, so up to JournalOptions::group_events records
+/// share one fsync. A group of one makes every event durable before its
+/// transition takes effect. Otherwise an effect is durable once Committed()
+/// reaches the sequence number of its record.
+///
+/// Checkpoint() compacts the journal: it writes Snapshot() of the machine
+/// next to the journal and truncates the journal. Open() recovers by
+/// restoring the snapshot and replaying the journal after it, handlers run
+/// again while OnEnter(...) of the restored state does not. A machine whose
+/// snapshot would leave out state data, see kSnapshotComplete, is never
+/// checkpointed and recovers from the whole journal instead.
+///
+/// Once writing the journal failed, see Ok(), every further event and tick
+/// is refused and reaches the machine no more. Only Handle(...),
+/// HandleBatch(...) and Process() of the adapter are journaled: timeouts and
+/// the queue of a Queued or Mailbox wrapped by the adapter dispatch to the
+/// machine directly, wrap the adapter in the queue instead. The events are
+/// stored as in an EventLogFormat. POSIX only.
+/// @tparam Machine   The adapted state machine, e.g. vsm::StateMachine<...>
+/// @tparam ...Events The event types that can be journaled
+template <typename Machine, typename... Events>
+class Journaled : public Machine {
+  struct Key {
+    explicit Key() = default;
+  };
+
+ public:
+  using Format = EventLogFormat<Events...>;
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief Version of the journal and snapshot layout
+  static constexpr std::uint32_t kVersion = 1;
+
+  /// @brief Constructs the machine from `args`, recovers it from the
+  /// snapshot and journal at `path` if they exist, and opens the journal
+  /// for appending. The journal is read up to its first invalid record,
+  /// usually a write torn by the crash, which is cut off.
+  /// @return Nothing if the files cannot be opened or belong to a different
+  /// layout version, event list or machine.
+  template <typename... Args>
+  static auto Open(std::string path, JournalOptions options, Args &&...args)
+      -> std::optional<Journaled>;
+
+  /// @brief Constructs the machine from `args` without recovering it. Only
+  /// Open() can name the key.
+  template <typename... Args>
+  Journaled(Key /* key */, std::string path, JournalOptions options,
+            Args &&...args)
+      : Machine{std::forward<Args>(args)...},
+        path_{std::move(path)},
+        options_{options},
+        buffer_(std::max<std::size_t>(options.group_events, 1) * kRecordSize) {
+  }
+
+  Journaled(Journaled &&other) noexcept
+      : Machine{std::move(other)},
+        path_{std::move(other.path_)},
+        options_{other.options_},
+        fd_{std::exchange(other.fd_, -1)},
+        buffer_{std::move(other.buffer_)},
+        used_{std::exchange(other.used_, 0)},
+        offset_{other.offset_},
+        journal_records_{other.journal_records_},
+        sequence_{other.sequence_},
+        committed_{other.committed_},
+        recovered_{other.recovered_},
+        first_pending_{other.first_pending_},
+        ok_{other.ok_} {}
+
+  Journaled(const Journaled &) = delete;
+  auto operator=(const Journaled &) = delete;
+  auto operator=(Journaled &&) = delete;
+
+  ~Journaled();
+
+  /// @brief Journals `event`, then forwards it to the machine. Refused once
+  /// the journal failed.
+  template <typename Event>
+  void Handle(Event &&event) {
+    if (!ok_) {
+      return;
+    }
+    Format::Encode(event, Append());
+    if (!Seal()) {
+      return;
+    }
+    Machine::Handle(std::forward<Event>(event));
+    MaybeCheckpoint();
+  }
+
+  /// @brief Journals and handles `n` events starting at `first` one by one.
+  template <typename Event>
+  void HandleBatch(const Event *first, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      Handle(first[i]);
+    }
+  }
+
+  /// @brief Journals and handles `n` events of different types starting at
+  /// `first` one by one.
+  template <typename... Variants>
+  void HandleBatch(const std::variant<Variants...> *first, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      std::visit([this](const auto &event) { Handle(event); }, first[i]);
+    }
+  }
+
+  /// @brief Journals a tick, then processes the machine. Refused once the
+  /// journal failed.
+  void Process() {
+    if (!ok_) {
+      return;
+    }
+    Format::EncodeType(Format::kTick, Append());
+    if (!Seal()) {
+      return;
+    }
+    Machine::Process();
+    MaybeCheckpoint();
+  }
+
+  /// @brief Writes the pending records and waits until they are durable.
+  /// @return False if the journal cannot be written, see Ok()
+  auto Commit() -> bool;
+
+  /// @brief Commits, then replaces the snapshot with one of the current
+  /// machine and empties the journal.
+  /// @return False if the snapshot or journal cannot be written, or the
+  /// snapshot would be incomplete
+  auto Checkpoint() -> bool;
+
+  /// @brief The sequence number of the last journaled record, counting from
+  /// one since the journal was created.
+  [[nodiscard]] auto Sequence() const -> std::uint64_t { return sequence_; }
+
+  /// @brief The sequence number of the last durable record.
+  [[nodiscard]] auto Committed() const -> std::uint64_t { return committed_; }
+
+  /// @brief The number of records Open() replayed.
+  [[nodiscard]] auto Recovered() const -> std::uint64_t { return recovered_; }
+
+  /// @brief False once writing the journal failed. Committed() no longer
+  /// advances and events are refused afterwards.
+  [[nodiscard]] auto Ok() const -> bool { return ok_; }
+
+ private:
+  struct Header {
+    std::array<char, 4> magic;
+    std::uint32_t version;
+    std::uint64_t hash;
+    std::uint64_t record_size;
+  };
+
+  struct SnapshotHeader {
+    std::array<char, 4> magic;
+    std::uint32_t version;
+    std::uint64_t sequence;
+  };
+
+  /// @brief Every record starts with its sequence number and a checksum,
+  /// followed by the event record of Format.
+  static constexpr std::size_t kPrefixSize = 16;
+  static constexpr std::size_t kRecordSize = kPrefixSize + Format::kRecordSize;
+
+  static constexpr std::array<char, 4> kMagic{'V', 'S', 'M', 'J'};
+  static constexpr std::array<char, 4> kSnapshotMagic{'V', 'S', 'M', 'C'};
+
+  static auto Checksum(const std::byte *record) -> std::uint32_t {
+    const auto hash = detail::Fnv1a(
+        std::string_view{reinterpret_cast<const char *>(record), 8},
+        0xcbf29ce484222325ULL);
+    return static_cast<std::uint32_t>(detail::Fnv1a(
+        std::string_view{reinterpret_cast<const char *>(record) + kPrefixSize,
+                         Format::kRecordSize},
+        hash));
+  }
+
+  static auto WriteAll(int fd, const std::byte *data, std::size_t size,
+                       std::size_t offset) -> bool;
+  static auto ReadAll(int fd, std::byte *data, std::size_t size) -> bool;
+  static auto SyncData(int fd) -> bool;
+  auto SyncDirectory() const -> bool;
+
+  auto SnapshotPath() const -> std::string { return path_ + ".snapshot"; }
+
+  /// @brief The event record of the next free journal record. A full
+  /// buffer is committed first, or dropped if that fails.
+  auto Append() -> std::byte * {
+    if (used_ == buffer_.size()) {
+      Commit();
+      used_ = 0;
+    }
+    if (used_ == 0) {
+      first_pending_ = Clock::now();
+    }
+    auto *record = buffer_.data() + used_;
+    used_ += kRecordSize;
+    return record + kPrefixSize;
+  }
+
+  /// @brief Numbers the last appended record and commits its group if it
+  /// is full or its window has passed.
+  /// @return False if the commit failed
+  auto Seal() -> bool {
+    auto *record = buffer_.data() + used_ - kRecordSize;
+    ++sequence_;
+    std::memcpy(record, &sequence_, sizeof(sequence_));
+    const auto checksum = Checksum(record);
+    std::memcpy(record + 8, &checksum, sizeof(checksum));
+    std::memset(record + 12, 0, 4);
+    if (used_ == buffer_.size() ||
+        Clock::now() - first_pending_ >= options_.group_window) {
+      return Commit();
+    }
+    return true;
+  }
+
+  void MaybeCheckpoint() {
+    if (Machine::kSnapshotComplete && options_.checkpoint_events != 0 &&
+        journal_records_ >= options_.checkpoint_events) {
+      Checkpoint();
+    }
+  }
+
+  auto Recover() -> bool;
+  auto LoadSnapshot() -> bool;
+
+  std::string path_;
+  JournalOptions options_;
+  int fd_ = -1;
+  std::vector<std::byte> buffer_;
+  std::size_t used_ = 0;
+  std::size_t offset_ = 0;
+  std::uint64_t journal_records_ = 0;
+  std::uint64_t sequence_ = 0;
+  std::uint64_t committed_ = 0;
+  std::uint64_t recovered_ = 0;
+  Clock::time_point first_pending_;
+  bool ok_ = true;
+};
+
+// =======================================================================
+// Implementation of Journaled Class
+// =======================================================================
+
+template <typename Machine, typename... Events>
+template <typename... Args>
+auto Journaled<Machine, Events...>::Open(std::string path,
+                                         JournalOptions options,
+                                         Args &&...args)
+    -> std::optional<Journaled> {
+  // Recovery may arm timeouts, which refer to the machine by address: it
+  // is recovered where it lives and the optional is not moved.
+  std::optional<Journaled> journaled;
+  journaled.emplace(Key{}, std::move(path), options,
+                    std::forward<Args>(args)...);
+  if (!journaled->Recover()) {
+    journaled.reset();
+  }
+  return journaled;
+}
+
+template <typename Machine, typename... Events>
+Journaled<Machine, Events...>::~Journaled() {
+  if (fd_ >= 0) {
+    Commit();
+    ::close(fd_);
+  }
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::Commit() -> bool {
+  if (used_ == 0 || !ok_) {
+    return ok_;
+  }
+  if (!WriteAll(fd_, buffer_.data(), used_, offset_) || !SyncData(fd_)) {
+    ok_ = false;
+    used_ = 0;
+    return false;
+  }
+  offset_ += used_;
+  journal_records_ += used_ / kRecordSize;
+  used_ = 0;
+  committed_ = sequence_;
+  return true;
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::Checkpoint() -> bool {
+  if (!Machine::kSnapshotComplete || !Commit()) {
+    return false;
+  }
+  const auto temporary = SnapshotPath() + ".tmp";
+  const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const SnapshotHeader header{kSnapshotMagic, kVersion, sequence_};
+  const auto snapshot = Machine::Snapshot();
+  const bool written =
+      WriteAll(fd, reinterpret_cast<const std::byte *>(&header),
+               sizeof(header), 0) &&
+      WriteAll(fd, snapshot.data(), snapshot.size(), sizeof(header)) &&
+      ::fsync(fd) == 0;
+  ::close(fd);
+  if (!written || std::rename(temporary.c_str(), SnapshotPath().c_str()) != 0 ||
+      !SyncDirectory()) {
+    return false;
+  }
+  // Records covered by the snapshot are skipped by Recover(), so a crash
+  // before the journal is emptied only leaves it longer than necessary.
+  if (ftruncate(fd_, sizeof(Header)) != 0 || !SyncData(fd_)) {
+    ok_ = false;
+    return false;
+  }
+  offset_ = sizeof(Header);
+  journal_records_ = 0;
+  return true;
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::LoadSnapshot() -> bool {
+  const int fd = ::open(SnapshotPath().c_str(), O_RDONLY);
+  if (fd < 0) {
+    return errno == ENOENT;
+  }
+  struct stat info {};
+  std::vector<std::byte> data;
+  if (fstat(fd, &info) == 0) {
+    data.resize(static_cast<std::size_t>(info.st_size));
+  }
+  const bool read = !data.empty() && ReadAll(fd, data.data(), data.size());
+  ::close(fd);
+  SnapshotHeader header{};
+  if (!read || data.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != kSnapshotMagic || header.version != kVersion ||
+      !Machine::Restore(data.data() + sizeof(header),
+                        data.size() - sizeof(header))) {
+    return false;
+  }
+  sequence_ = header.sequence;
+  committed_ = header.sequence;
+  return true;
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::Recover() -> bool {
+  if (!LoadSnapshot()) {
+    return false;
+  }
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat info {};
+  if (fd_ < 0 || fstat(fd_, &info) != 0) {
+    return false;
+  }
+  const auto size = static_cast<std::size_t>(info.st_size);
+  const Header expected{kMagic, kVersion, Format::kHash, kRecordSize};
+  if (size < sizeof(Header)) {
+    offset_ = sizeof(Header);
+    return ftruncate(fd_, 0) == 0 &&
+           WriteAll(fd_, reinterpret_cast<const std::byte *>(&expected),
+                    sizeof(expected), 0) &&
+           SyncData(fd_) && SyncDirectory();
+  }
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(map, size, MADV_SEQUENTIAL);
+#endif
+  const auto *data = static_cast<const std::byte *>(map);
+  Header header{};
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != kMagic || header.version != kVersion ||
+      header.hash != Format::kHash || header.record_size != kRecordSize) {
+    munmap(map, size);
+    return false;
+  }
+  offset_ = sizeof(Header);
+  for (; offset_ + kRecordSize <= size; offset_ += kRecordSize) {
+    const auto *record = data + offset_;
+    std::uint64_t sequence = 0;
+    std::uint32_t checksum = 0;
+    std::memcpy(&sequence, record, sizeof(sequence));
+    std::memcpy(&checksum, record + 8, sizeof(checksum));
+    if (checksum != Checksum(record)) {
+      break;
+    }
+    if (sequence <= sequence_) {
+      ++journal_records_;
+      continue;
+    }
+    if (sequence != sequence_ + 1 ||
+        !Format::Apply(static_cast<Machine &>(*this), record + kPrefixSize)) {
+      break;
+    }
+    sequence_ = sequence;
+    ++journal_records_;
+    ++recovered_;
+  }
+  munmap(map, size);
+  committed_ = sequence_;
+  return offset_ == size ||
+         (ftruncate(fd_, static_cast<off_t>(offset_)) == 0 && SyncData(fd_));
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::WriteAll(int fd, const std::byte *data,
+                                             std::size_t size,
+                                             std::size_t offset) -> bool {
+  while (size > 0) {
+    const auto written =
+        ::pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+    offset += static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::ReadAll(int fd, std::byte *data,
+                                            std::size_t size) -> bool {
+  while (size > 0) {
+    const auto read = ::read(fd, data, size);
+    if (read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (read <= 0) {
+      return false;
+    }
+    data += read;
+    size -= static_cast<std::size_t>(read);
+  }
+  return true;
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::SyncData(int fd) -> bool {
+#if defined(__linux__)
+  return ::fdatasync(fd) == 0;
+#else
+  return ::fsync(fd) == 0;
+#endif
+}
+
+template <typename Machine, typename... Events>
+auto Journaled<Machine, Events...>::SyncDirectory() const -> bool {
+  const auto slash = path_.rfind('/');
+  const auto directory =
+      slash == std::string::npos ? std::string{"."}
+                                 : path_.substr(0, std::max<std::size_t>(
+                                                       slash, 1));
+  const int fd = ::open(directory.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  const bool synced = ::fsync(fd) == 0;
+  ::close(fd);
+  return synced;
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,302 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_LATENCY_H_
+#define VARIADICSTATEMACHINE_LATENCY_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "vsm/clock.hpp"
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief Log-linear histogram of tick counts. Every power of two is split
+/// into kSubBuckets linear buckets, so a recorded value is known to within
+/// 1/kSubBuckets of itself over the whole 64 bit range.
+class LatencyHistogram {
+ public:
+  static constexpr unsigned kSubBits = 5;
+  static constexpr std::size_t kSubBuckets = std::size_t{1} << kSubBits;
+  static constexpr std::size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+  void Record(std::uint64_t value) { counts_[BucketOf(value)]++; }
+
+  auto operator+=(const LatencyHistogram &other) -> LatencyHistogram & {
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    return *this;
+  }
+
+  /// @brief The number of recorded values.
+  [[nodiscard]] auto Count() const -> std::uint64_t;
+
+  /// @brief The value below which `quantile` of all recorded values lie,
+  /// the midpoint of its bucket. Zero if nothing was recorded.
+  [[nodiscard]] auto ValueAt(double quantile) const -> std::uint64_t;
+
+  /// @brief The bucket counting `value`.
+  [[nodiscard]] static constexpr auto BucketOf(std::uint64_t value)
+      -> std::size_t;
+
+  /// @brief The smallest value counted by `bucket`.
+  [[nodiscard]] static constexpr auto LowerBound(std::size_t bucket)
+      -> std::uint64_t;
+
+  /// @brief The number of values counted by `bucket`.
+  [[nodiscard]] static constexpr auto Width(std::size_t bucket)
+      -> std::uint64_t;
+
+ private:
+  friend class LatencyRegistry;
+
+  std::array<std::uint64_t, kBuckets> counts_{};
+};
+
+/// @brief The merged latencies of handling `event` in `state` on all
+/// threads. The names are empty for types without Name().
+struct LatencyReport {
+  std::string state;
+  std::string event;
+  LatencyHistogram histogram;
+  double ticks_per_us = 1.0;
+
+  [[nodiscard]] auto Percentile(double quantile) const
+      -> std::chrono::nanoseconds {
+    return std::chrono::nanoseconds{static_cast<std::int64_t>(
+        static_cast<double>(histogram.ValueAt(quantile)) * 1000.0 /
+        ticks_per_us)};
+  }
+
+  [[nodiscard]] auto P50() const { return Percentile(0.5); }
+  [[nodiscard]] auto P99() const { return Percentile(0.99); }
+  [[nodiscard]] auto P999() const { return Percentile(0.999); }
+};
+
+/// @brief Process-wide list of the thread-local histograms, one per thread,
+/// state and event type. Recording never takes a lock, only the first
+/// recording of a combination on a thread does.
+class LatencyRegistry {
+ public:
+  [[nodiscard]] static auto Instance() -> LatencyRegistry & {
+    static LatencyRegistry registry;
+    return registry;
+  }
+
+  /// @brief Records `ticks` for handling `Event` in `State` on this thread.
+  template <typename State, typename Event>
+  static void Record(std::uint64_t ticks) {
+    thread_local Local &local = Instance().Add(
+        &detail::TypeTag<State>::kTag, &detail::TypeTag<Event>::kTag,
+        NameOf<State>(), NameOf<Event>());
+    auto &count = local.counts[LatencyHistogram::BucketOf(ticks)];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  }
+
+  /// @brief Merges the histograms of all threads, one report per state and
+  /// event type.
+  [[nodiscard]] auto Collect() -> std::vector<LatencyReport>;
+
+ private:
+  /// @brief Histogram written by a single thread, readable by Collect().
+  struct Local {
+    const void *state;
+    const void *event;
+    std::string state_name;
+    std::string event_name;
+    std::array<std::atomic<std::uint64_t>, LatencyHistogram::kBuckets>
+        counts{};
+  };
+
+  LatencyRegistry() = default;
+
+  template <typename T>
+  static auto NameOf() -> std::string_view {
+    if constexpr (detail::HasName<T>::value) {
+      return T::Name();
+    } else {
+      return {};
+    }
+  }
+
+  auto Add(const void *state, const void *event, std::string_view state_name,
+           std::string_view event_name) -> Local &;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Local>> locals_;
+};
+
+/// @brief Observer measuring how long every Handle(...) takes, including the
+/// transition, per state and event type. Uses TickClock for timing, see
+/// CollectLatencies() for the results.
+///
+/// An event handled from within another one, e.g. from OnEnter(...), is
+/// measured on its own and as part of the outer event. Events nested deeper
+/// than kMaxDepth are not measured.
+class LatencyObserver : public NoObserver {
+ public:
+  static constexpr std::size_t kMaxDepth = 8;
+
+  template <typename State, typename Event>
+  void OnEventDispatched(const Event & /* event */) {
+    if (depth_ < kMaxDepth) {
+      starts_[depth_] = TickClock::Now();
+    }
+    ++depth_;
+  }
+
+  template <typename State, typename Event>
+  void OnEventHandled() {
+    --depth_;
+    if (depth_ < kMaxDepth) {
+      LatencyRegistry::Record<State, Event>(TickClock::Now() -
+                                            starts_[depth_]);
+    }
+  }
+
+ private:
+  /// @brief The start of every event being handled, innermost last
+  std::array<std::uint64_t, kMaxDepth> starts_{};
+  std::size_t depth_ = 0;
+};
+
+/// @brief The latencies recorded by all LatencyObservers on all threads.
+[[nodiscard]] inline auto CollectLatencies() -> std::vector<LatencyReport> {
+  return LatencyRegistry::Instance().Collect();
+}
+
+// =======================================================================
+// Implementation of LatencyHistogram Class
+// =======================================================================
+
+inline auto LatencyHistogram::Count() const -> std::uint64_t {
+  std::uint64_t count = 0;
+  for (const auto bucket : counts_) {
+    count += bucket;
+  }
+  return count;
+}
+
+inline auto LatencyHistogram::ValueAt(double quantile) const
+    -> std::uint64_t {
+  const auto count = Count();
+  if (count == 0) {
+    return 0;
+  }
+  const auto rank = static_cast<std::uint64_t>(
+      quantile * static_cast<double>(count - 1));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    seen += counts_[i];
+    if (seen > rank) {
+      return LowerBound(i) + Width(i) / 2;
+    }
+  }
+  return LowerBound(kBuckets - 1);
+}
+
+constexpr auto LatencyHistogram::BucketOf(std::uint64_t value)
+    -> std::size_t {
+  if (value < kSubBuckets) {
+    return static_cast<std::size_t>(value);
+  }
+#if defined(__GNUC__)
+  const auto log2 = 63U - static_cast<unsigned>(__builtin_clzll(value));
+#else
+  unsigned log2 = kSubBits;
+  while ((value >> (log2 + 1)) != 0) {
+    ++log2;
+  }
+#endif
+  const auto group = log2 - kSubBits + 1;
+  const auto sub = (value >> (log2 - kSubBits)) - kSubBuckets;
+  return group * kSubBuckets + static_cast<std::size_t>(sub);
+}
+
+constexpr auto LatencyHistogram::LowerBound(std::size_t bucket)
+    -> std::uint64_t {
+  const auto group = bucket / kSubBuckets;
+  const auto sub = bucket % kSubBuckets;
+  if (group == 0) {
+    return sub;
+  }
+  return static_cast<std::uint64_t>(kSubBuckets + sub) << (group - 1);
+}
+
+constexpr auto LatencyHistogram::Width(std::size_t bucket) -> std::uint64_t {
+  const auto group = bucket / kSubBuckets;
+  return group == 0 ? 1 : std::uint64_t{1} << (group - 1);
+}
+
+// =======================================================================
+// Implementation of LatencyRegistry Class
+// =======================================================================
+
+inline auto LatencyRegistry::Add(const void *state, const void *event,
+                                 std::string_view state_name,
+                                 std::string_view event_name) -> Local & {
+  std::lock_guard lock{mutex_};
+  auto local = std::make_unique<Local>();
+  local->state = state;
+  local->event = event;
+  local->state_name = state_name;
+  local->event_name = event_name;
+  locals_.push_back(std::move(local));
+  return *locals_.back();
+}
+
+inline auto LatencyRegistry::Collect() -> std::vector<LatencyReport> {
+  std::lock_guard lock{mutex_};
+  std::vector<LatencyReport> reports;
+  std::vector<std::pair<const void *, const void *>> keys;
+  for (const auto &local : locals_) {
+    const auto key = std::pair{local->state, local->event};
+    std::size_t i = 0;
+    while (i < keys.size() && keys[i] != key) {
+      ++i;
+    }
+    if (i == keys.size()) {
+      keys.push_back(key);
+      reports.push_back(LatencyReport{local->state_name, local->event_name,
+                                      {}, TickClock::TicksPerMicrosecond()});
+    }
+    auto &counts = reports[i].histogram.counts_;
+    for (std::size_t b = 0; b < LatencyHistogram::kBuckets; ++b) {
+      counts[b] += local->counts[b].load(std::memory_order_relaxed);
+    }
+  }
+  return reports;
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,429 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_MAPPED_POOL_H_
+#define VARIADICSTATEMACHINE_MAPPED_POOL_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "vsm/pool.hpp"
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief How a MappedStateMachinePool maps its file.
+struct MapOptions {
+  /// @brief Instances the file has room for when it is created
+  std::size_t capacity = 1024;
+
+  /// @brief Advises the kernel to back the mapping with huge pages, which
+  /// only takes effect on file systems supporting them (tmpfs, hugetlbfs).
+  bool huge_pages = false;
+};
+
+/// @brief A fleet of identical machines living in a memory-mapped file. Each
+/// instance is one fixed-size record holding its state index and the data
+/// of its states, so the file only ever grows at its end. Reopening the file
+/// after a restart maps it and resumes every instance where it was, in a
+/// time independent of the number of instances. OnEnter(...) is not called
+/// again. An instance whose stored state index is out of range, e.g. after
+/// the file was damaged, ignores every event and is in no state.
+///
+/// All states must be trivially copyable, composites are not supported.
+/// Changes reach the file eventually, Sync() makes them durable. POSIX only.
+template <typename InitialState, typename... States>
+class MappedStateMachinePool {
+ public:
+  using Id = std::size_t;
+
+  /// @brief Version of the file layout
+  static constexpr std::uint32_t kLayoutVersion = 1;
+
+  /// @brief Opens the pool stored at `path`, or creates an empty one.
+  /// @return Nothing if the file cannot be mapped or belongs to a different
+  /// layout version or list of states.
+  static auto Open(const char *path, MapOptions options = {})
+      -> std::optional<MappedStateMachinePool>;
+
+  MappedStateMachinePool(MappedStateMachinePool &&other) noexcept
+      : fd_{std::exchange(other.fd_, -1)},
+        map_{std::exchange(other.map_, nullptr)},
+        mapped_{std::exchange(other.mapped_, 0)},
+        options_{other.options_} {}
+
+  auto operator=(MappedStateMachinePool &&other) noexcept
+      -> MappedStateMachinePool & {
+    std::swap(fd_, other.fd_);
+    std::swap(map_, other.map_);
+    std::swap(mapped_, other.mapped_);
+    options_ = other.options_;
+    return *this;
+  }
+
+  MappedStateMachinePool(const MappedStateMachinePool &) = delete;
+  auto operator=(const MappedStateMachinePool &) = delete;
+
+  ~MappedStateMachinePool();
+
+  /// @brief Adds an instance that begins in `initial_state`, grows the file
+  /// if it is full.
+  /// @return The id of the new instance, nothing if the file cannot grow
+  auto Add(const InitialState &initial_state, const States &...states)
+      -> std::optional<Id>;
+
+  /// @brief The number of instances.
+  [[nodiscard]] auto Size() const -> std::size_t { return Header().size; }
+
+  /// @brief Instances that fit into the file without growing it.
+  [[nodiscard]] auto Capacity() const -> std::size_t {
+    return Header().capacity;
+  }
+
+  /// @brief Calls the initial transition of the instance `id`.
+  void InitialTransition(Id id) {
+    auto &state = GetState<InitialState>(id);
+    if constexpr (detail::HasOnEnter<InitialState &>::value) {
+      state.OnEnter();
+    }
+  }
+
+  /// @brief Processes the current state of the instance `id`.
+  /// Note: Might result in a transition.
+  void Process(Id id);
+
+  /// @brief Processes the current state of every instance in id order.
+  void ProcessAll() {
+    for (Id id = 0; id < Size(); ++id) {
+      Process(id);
+    }
+  }
+
+  /// @brief Forwards the event to the active state of the instance `id`,
+  /// states without a matching Handle(...) ignore it.
+  /// Note: Might result in a transition.
+  template <typename Event>
+  void Handle(Id id, const Event &event);
+
+  /// @brief Checks if the instance `id` is currently in a specific state.
+  template <typename State>
+  [[nodiscard]] auto IsInState(Id id) const -> bool {
+    static_assert(kContains<State>, "State not part of state machine");
+    return Current(id) == kIndexOf<State>;
+  }
+
+  /// @brief Returns a specific state of the instance `id`
+  template <typename State>
+  [[nodiscard]] auto GetState(Id id) -> State & {
+    static_assert(kContains<State>, "State not part of state machine");
+    return *std::launder(reinterpret_cast<State *>(
+        Record(id) + kOffsets[kIndexOf<State>]));
+  }
+
+  /// @brief Writes all changes to the file and waits for the device, a
+  /// checkpoint surviving a crash of the whole system.
+  /// @param wait   Only schedules the write back if false
+  /// @return false if the write back failed
+  auto Sync(bool wait = true) -> bool {
+    return msync(map_, mapped_, wait ? MS_SYNC : MS_ASYNC) == 0;
+  }
+
+ private:
+  template <typename>
+  friend class detail::PoolInstance;
+
+  using Index = detail::StateIndex<1 + sizeof...(States)>;
+
+  static_assert((std::is_trivially_copyable_v<InitialState> && ... &&
+                 std::is_trivially_copyable_v<States>),
+                "States of a mapped pool must be trivially copyable");
+
+  template <typename State>
+  static constexpr bool kContains =
+      (std::is_same_v<State, InitialState> ||
+       (std::is_same_v<State, States> || ...));
+
+  template <typename State>
+  static constexpr auto kIndexOf =
+      static_cast<Index>(detail::index_of_v<State, InitialState, States...>);
+
+  /// @brief Byte offsets of the states within a record, the index is first.
+  static constexpr auto kOffsets = [] {
+    constexpr std::array<std::size_t, 1 + sizeof...(States)> kSizes{
+        sizeof(InitialState), sizeof(States)...};
+    constexpr std::array<std::size_t, 1 + sizeof...(States)> kAligns{
+        alignof(InitialState), alignof(States)...};
+    std::array<std::size_t, 1 + sizeof...(States)> offsets{};
+    auto offset = sizeof(Index);
+    for (std::size_t i = 0; i < offsets.size(); ++i) {
+      offset = (offset + kAligns[i] - 1) / kAligns[i] * kAligns[i];
+      offsets[i] = offset;
+      offset += kSizes[i];
+    }
+    return offsets;
+  }();
+
+  static constexpr std::size_t kAlign =
+      std::max({alignof(Index), alignof(InitialState), alignof(States)...});
+
+  using Last = detail::type_at_t<sizeof...(States),
+                                 detail::TypeList<InitialState, States...>>;
+
+  static constexpr std::size_t kRecordSize =
+      (kOffsets.back() + sizeof(Last) + kAlign - 1) / kAlign * kAlign;
+
+  /// @brief The fixed header at the start of the file
+  struct FileHeader {
+    std::array<char, 4> magic;
+    std::uint32_t version;
+    std::uint64_t hash;
+    std::uint64_t record_size;
+    std::uint64_t capacity;
+    std::uint64_t size;
+  };
+
+  static constexpr std::array<char, 4> kMagic{'V', 'S', 'M', 'F'};
+
+  /// @brief Records start at a page-independent, aligned offset
+  static constexpr std::size_t kRecordsOffset =
+      (sizeof(FileHeader) + 63) / 64 * 64;
+
+  static_assert(kAlign <= 64, "State alignment above 64 is not supported");
+
+  /// @brief Hash of the states and the record layout
+  static constexpr std::uint64_t kHash =
+      detail::SnapshotLayoutHash<InitialState, States...>() ^ kRecordSize;
+
+  MappedStateMachinePool(int fd, void *map, std::size_t mapped,
+                         MapOptions options)
+      : fd_{fd}, map_{map}, mapped_{mapped}, options_{options} {}
+
+  /// @brief Maps the first `size` bytes of `fd`.
+  static auto Map(int fd, std::size_t size, MapOptions options) -> void *;
+
+  /// @brief Grows the file to `capacity` records and maps it again.
+  auto Grow(std::size_t capacity) -> bool;
+
+  [[nodiscard]] auto Header() const -> FileHeader & {
+    return *std::launder(reinterpret_cast<FileHeader *>(map_));
+  }
+
+  [[nodiscard]] auto Record(Id id) const -> std::byte * {
+    return static_cast<std::byte *>(map_) + kRecordsOffset + id * kRecordSize;
+  }
+
+  [[nodiscard]] auto Current(Id id) const -> Index {
+    Index index{};
+    std::memcpy(&index, Record(id), sizeof(Index));
+    return index;
+  }
+
+  void SetCurrent(Id id, Index index) {
+    std::memcpy(Record(id), &index, sizeof(Index));
+  }
+
+  static constexpr auto FileSize(std::size_t capacity) -> std::size_t {
+    return kRecordsOffset + capacity * kRecordSize;
+  }
+
+  /// @brief Calls `visitor` with the active state of the instance `id`,
+  /// through a compile-time table indexed by its state index.
+  template <typename Visitor>
+  void Dispatch(Id id, Visitor &visitor);
+
+  template <std::size_t I, typename Visitor>
+  static void DispatchTo(MappedStateMachinePool &pool, Id id,
+                         Visitor &visitor) {
+    using State = std::tuple_element_t<I, std::tuple<InitialState, States...>>;
+    visitor(pool.template GetState<State>(id), id);
+  }
+
+  template <typename Visitor, std::size_t... I>
+  static constexpr auto MakeDispatchTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = void (*)(MappedStateMachinePool &, Id, Visitor &);
+    return std::array<Fn, sizeof...(I)>{&DispatchTo<I, Visitor>...};
+  }
+
+  int fd_;
+  void *map_;
+  std::size_t mapped_;
+  MapOptions options_;
+};
+
+// =======================================================================
+// Implementation of MappedStateMachinePool Class
+// =======================================================================
+
+template <typename InitialState, typename... States>
+auto MappedStateMachinePool<InitialState, States...>::Open(
+    const char *path, MapOptions options)
+    -> std::optional<MappedStateMachinePool> {
+  const int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    ::close(fd);
+    return std::nullopt;
+  }
+  const bool created = info.st_size == 0;
+  auto size = static_cast<std::size_t>(info.st_size);
+  if (created) {
+    options.capacity = std::max<std::size_t>(options.capacity, 1);
+    size = FileSize(options.capacity);
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      ::close(fd);
+      return std::nullopt;
+    }
+  } else if (size < kRecordsOffset) {
+    ::close(fd);
+    return std::nullopt;
+  }
+  void *map = Map(fd, size, options);
+  if (map == nullptr) {
+    ::close(fd);
+    return std::nullopt;
+  }
+  MappedStateMachinePool pool{fd, map, size, options};
+  auto &header = pool.Header();
+  if (created) {
+    header = FileHeader{kMagic, kLayoutVersion, kHash, kRecordSize,
+                        options.capacity, 0};
+  } else if (header.magic != kMagic || header.version != kLayoutVersion ||
+             header.hash != kHash || header.record_size != kRecordSize ||
+             FileSize(header.capacity) > size ||
+             header.size > header.capacity) {
+    return std::nullopt;
+  }
+  return pool;
+}
+
+template <typename InitialState, typename... States>
+MappedStateMachinePool<InitialState, States...>::~MappedStateMachinePool() {
+  if (map_ != nullptr) {
+    munmap(map_, mapped_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+template <typename InitialState, typename... States>
+auto MappedStateMachinePool<InitialState, States...>::Map(int fd,
+                                                          std::size_t size,
+                                                          MapOptions options)
+    -> void * {
+  void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    return nullptr;
+  }
+#ifdef MADV_HUGEPAGE
+  if (options.huge_pages) {
+    madvise(map, size, MADV_HUGEPAGE);
+  }
+#else
+  static_cast<void>(options);
+#endif
+  return map;
+}
+
+template <typename InitialState, typename... States>
+auto MappedStateMachinePool<InitialState, States...>::Grow(
+    std::size_t capacity) -> bool {
+  const auto size = FileSize(capacity);
+  if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+    return false;
+  }
+  void *map = Map(fd_, size, options_);
+  if (map == nullptr) {
+    return false;
+  }
+  munmap(map_, mapped_);
+  map_ = map;
+  mapped_ = size;
+  Header().capacity = capacity;
+  return true;
+}
+
+template <typename InitialState, typename... States>
+auto MappedStateMachinePool<InitialState, States...>::Add(
+    const InitialState &initial_state, const States &...states)
+    -> std::optional<Id> {
+  const Id id = Size();
+  if (id == Capacity() && !Grow(2 * Capacity())) {
+    return std::nullopt;
+  }
+  auto *record = Record(id);
+  SetCurrent(id, kIndexOf<InitialState>);
+  new (record + kOffsets[kIndexOf<InitialState>]) InitialState(initial_state);
+  (new (record + kOffsets[kIndexOf<States>]) States(states), ...);
+  Header().size = id + 1;
+  return id;
+}
+
+template <typename InitialState, typename... States>
+void MappedStateMachinePool<InitialState, States...>::Process(Id id) {
+  auto state_visitor = [this](auto &state, Id instance_id) {
+    detail::ProcessInstance(*this, instance_id, state);
+  };
+  Dispatch(id, state_visitor);
+}
+
+template <typename InitialState, typename... States>
+template <typename Event>
+void MappedStateMachinePool<InitialState, States...>::Handle(
+    Id id, const Event &event) {
+  auto state_visitor = [this, &event](auto &state, Id instance_id) {
+    detail::HandleInstance(*this, instance_id, state, event);
+  };
+  Dispatch(id, state_visitor);
+}
+
+template <typename InitialState, typename... States>
+template <typename Visitor>
+void MappedStateMachinePool<InitialState, States...>::Dispatch(
+    Id id, Visitor &visitor) {
+  static constexpr auto kTable = MakeDispatchTable<Visitor>(
+      std::index_sequence_for<InitialState, States...>{});
+  const auto current = Current(id);
+  if (current > sizeof...(States)) {
+    return;
+  }
+  kTable[current](*this, id, visitor);
+}
+
+}  // namespace vsm
+
+#endif
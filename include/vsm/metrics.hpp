@@ -0,0 +1,159 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_METRICS_H_
+#define VARIADICSTATEMACHINE_METRICS_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief Transition counts and dwell times of one or more machines over
+/// the same `N` states. Plain values, metrics of many machines are
+/// aggregated by adding their snapshots.
+template <std::size_t N>
+struct Metrics {
+  using Duration = std::chrono::steady_clock::duration;
+
+  /// @brief How often the edge [from][to] was taken
+  std::array<std::array<std::uint64_t, N>, N> transitions{};
+
+  /// @brief Time spent in every state
+  std::array<Duration, N> dwell{};
+
+  auto operator+=(const Metrics &other) -> Metrics & {
+    for (std::size_t from = 0; from < N; ++from) {
+      for (std::size_t to = 0; to < N; ++to) {
+        transitions[from][to] += other.transitions[from][to];
+      }
+      dwell[from] += other.dwell[from];
+    }
+    return *this;
+  }
+};
+
+/// @brief Observer counting every transition edge and accumulating the time
+/// spent in each state. A transition costs one clock read and two adds.
+/// The metrics belong to a single machine and take no locks. Time is only
+/// counted from InitialTransition() or the first transition on.
+///
+/// Only leaf states are metered, like the machine tracks only its active
+/// leaf: a composite has no entry of its own, the time spent in it is that
+/// of its children. An edge leads from the leaf that was active, also if
+/// a composite handled the event, to the leaf that was entered.
+/// @tparam InitialState  The state the machine begins in
+/// @tparam ...States     The remaining states, as given to the machine, see
+/// MeteredStateMachine to list them only once.
+template <typename InitialState, typename... States>
+class MetricsObserver : public NoObserver {
+  using Paths = typename detail::Concat<
+      typename detail::LeafPaths<InitialState>::type,
+      typename detail::LeafPaths<States>::type...>::type;
+
+ public:
+  static constexpr std::size_t kStates = detail::Size<Paths>::value;
+
+  using Clock = std::chrono::steady_clock;
+  using Snapshot = Metrics<kStates>;
+
+  template <typename State>
+  void OnInitialTransition() {
+    entered_ = Clock::now();
+    current_ = kIndexOf<State>;
+    started_ = true;
+  }
+
+  template <typename From, typename To, typename... Event>
+  void OnTransition(const Event &.../* event */) {
+    const auto now = Clock::now();
+    metrics_.transitions[current_][kIndexOf<To>]++;
+    if (started_) {
+      metrics_.dwell[current_] += now - entered_;
+    }
+    entered_ = now;
+    current_ = kIndexOf<To>;
+    started_ = true;
+  }
+
+  /// @brief The metrics so far, including the time spent in the active state
+  /// up to now.
+  [[nodiscard]] auto GetMetrics() const -> Snapshot {
+    auto metrics = metrics_;
+    if (started_) {
+      metrics.dwell[current_] += Clock::now() - entered_;
+    }
+    return metrics;
+  }
+
+  /// @brief Returns the metrics so far and starts counting from zero.
+  auto ResetMetrics() -> Snapshot {
+    const auto now = Clock::now();
+    auto metrics = metrics_;
+    if (started_) {
+      metrics.dwell[current_] += now - entered_;
+    }
+    metrics_ = Snapshot{};
+    entered_ = now;
+    return metrics;
+  }
+
+  /// @brief The index of `State` in the metrics, for a composite or its
+  /// parent that of the leaf entered with it
+  template <typename State>
+  static constexpr std::size_t kIndexOf = [] {
+    constexpr auto kIndex = detail::LeafRange<State>(Paths{}).first;
+    static_assert(kIndex < kStates, "State not part of the metrics");
+    return kIndex;
+  }();
+
+ private:
+  Snapshot metrics_;
+  Clock::time_point entered_;
+  detail::StateIndex<kStates> current_ = 0;
+  bool started_ = false;
+};
+
+/// @brief A state machine collecting MetricsObserver metrics over its own
+/// states.
+template <typename InitialState, typename... States>
+class MeteredStateMachine
+    : public BasicStateMachine<MetricsObserver<InitialState, States...>,
+                               InitialState, States...> {
+ public:
+  /// @brief Constructs a new state machine.
+  /// @param initial_state  The initial state the state machine begins in.
+  /// @param states         The remaining states the state machine can
+  /// transition to.
+  explicit MeteredStateMachine(InitialState initial_state, States... states)
+      : BasicStateMachine<MetricsObserver<InitialState, States...>,
+                          InitialState, States...>{
+            MetricsObserver<InitialState, States...>{},
+            std::move(initial_state), std::move(states)...} {}
+};
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,385 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#ifndef VARIADICSTATEMACHINE_POOL_H_
+#define VARIADICSTATEMACHINE_POOL_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+namespace detail {
+
+/// @brief Contiguous per-instance storage of one state type.
+template <typename State, typename = void>
+class StateArray {
+ public:
+  StateArray() = default;
+  StateArray(std::size_t size, const State &state) : states_(size, state) {}
+
+  void PushBack(State state) { states_.push_back(std::move(state)); }
+  auto operator[](std::size_t id) -> State & { return states_[id]; }
+
+ private:
+  std::vector<State> states_;
+};
+
+/// @brief Stateless states are shared by all instances and take no memory.
+template <typename State>
+class StateArray<State, std::enable_if_t<std::is_empty_v<State>>> {
+ public:
+  StateArray() = default;
+  StateArray(std::size_t /* size */, const State &state) : state_{state} {}
+
+  void PushBack(const State & /* state */) {}
+  auto operator[](std::size_t /* id */) -> State & { return state_; }
+
+ private:
+  State state_{};
+};
+
+/// @brief The state machine of a single instance of `Pool` as seen by
+/// transitions, which hand the new state index to Pool::SetCurrent(...).
+template <typename Pool>
+class PoolInstance {
+ public:
+  PoolInstance(Pool &pool, typename Pool::Id id) : pool_{pool}, id_{id} {}
+
+  [[nodiscard]] auto GetObserver() -> NoObserver & { return observer_; }
+
+ private:
+  template <typename, typename>
+  friend struct vsm::TransitionTo;
+
+  template <typename From, typename To, typename ExitFn, typename EnterFn,
+            typename... Args>
+  void Transition(ExitFn &&exit, EnterFn &&enter, Args &&.../* args */) {
+    static_assert(Pool::template kContains<To>,
+                  "Invalid state transition: State not part of state machine");
+    exit(pool_.template GetState<From>(id_));
+    pool_.SetCurrent(id_, Pool::template kIndexOf<To>);
+    enter(pool_.template GetState<To>(id_));
+  }
+
+  Pool &pool_;
+  typename Pool::Id id_;
+  NoObserver observer_;
+};
+
+/// @brief Calls Process() of `state`, the active state of the instance `id`
+/// of `pool`, if it has one.
+template <typename Pool, typename State>
+void ProcessInstance(Pool &pool, typename Pool::Id id, State &state) {
+  if constexpr (HasProcess<State>::value) {
+    PoolInstance<Pool> instance{pool, id};
+    state.Process().Execute(instance, state);
+  }
+}
+
+/// @brief Calls Handle(...) of `state`, the active state of the instance
+/// `id` of `pool`, if it has one for `Event`.
+template <typename Pool, typename State, typename Event>
+void HandleInstance(Pool &pool, typename Pool::Id id, State &state,
+                    const Event &event) {
+  if constexpr (HasHandle<State, const Event &>::value) {
+    PoolInstance<Pool> instance{pool, id};
+    state.Handle(event).Execute(instance, state, event);
+  }
+}
+
+}  // namespace detail
+
+/// @brief Holds many instances of the same state machine. Each state type's
+/// data lives in its own contiguous array and the active states in one array
+/// of compact indices, an instance costs the size of its states, the index
+/// and its membership slot. There is no observer.
+///
+/// Instances in a state with Process() are additionally kept in a membership
+/// list per state, so ProcessAll() runs one monomorphic loop per state type
+/// and never looks at instances in states without Process().
+template <typename InitialState, typename... States>
+class StateMachinePool {
+ public:
+  using Id = std::size_t;
+
+  StateMachinePool() = default;
+
+  /// @brief Constructs `size` instances, each a copy of the given states.
+  StateMachinePool(std::size_t size, const InitialState &initial_state,
+                   const States &...states);
+
+  /// @brief Adds an instance that begins in `initial_state`.
+  /// @return The id of the new instance
+  auto Add(InitialState initial_state, States... states) -> Id;
+
+  /// @brief The number of instances.
+  [[nodiscard]] auto Size() const -> std::size_t { return current_.size(); }
+
+  /// @brief Calls the initial transition of the instance `id`.
+  void InitialTransition(Id id) {
+    if constexpr (detail::HasOnEnter<InitialState &>::value) {
+      std::get<kIndexOf<InitialState>>(states_)[id].OnEnter();
+    }
+  }
+
+  /// @brief Processes the current state of the instance `id`.
+  /// Note: Might result in a transition.
+  void Process(Id id);
+
+  /// @brief Processes the current state of every instance, grouped by state.
+  /// Transitions take effect immediately but the membership lists are only
+  /// updated afterwards, so every instance is processed exactly once.
+  void ProcessAll();
+
+  /// @brief Forwards the event to the active state of the instance `id`,
+  /// states without a matching Handle(...) ignore it.
+  /// Note: Might result in a transition.
+  template <typename Event>
+  void Handle(Id id, const Event &event);
+
+  /// @brief Checks if the instance `id` is currently in a specific state.
+  template <typename State>
+  [[nodiscard]] auto IsInState(Id id) const -> bool {
+    static_assert(kContains<State>, "State not part of state machine");
+    return current_[id] == kIndexOf<State>;
+  }
+
+  /// @brief Returns a specific state of the instance `id`
+  template <typename State>
+  [[nodiscard]] auto GetState(Id id) -> State & {
+    return std::get<kIndexOf<State>>(states_)[id];
+  }
+
+ private:
+  template <typename>
+  friend class detail::PoolInstance;
+
+  using Index = detail::StateIndex<1 + sizeof...(States)>;
+
+  template <typename State>
+  static constexpr bool kContains =
+      (std::is_same_v<State, InitialState> ||
+       (std::is_same_v<State, States> || ...));
+
+  template <typename State>
+  static constexpr auto kIndexOf =
+      static_cast<Index>(detail::index_of_v<State, InitialState, States...>);
+
+  /// @brief Makes `index` the active state of `id` after a transition.
+  void SetCurrent(Id id, Index index) {
+    const auto from = current_[id];
+    current_[id] = index;
+    Moved(id, from);
+  }
+
+  /// @brief A membership change postponed until the end of ProcessAll()
+  struct Move {
+    Id id;
+    Index from;
+  };
+
+  static auto HasProcess(Index state) -> bool {
+    constexpr std::array<bool, 1 + sizeof...(States)> kHasProcess{
+        detail::HasProcess<InitialState>::value,
+        detail::HasProcess<States>::value...};
+    return kHasProcess[state];
+  }
+
+  /// @brief Adds `id` to the membership list of `state`.
+  void Join(Id id, Index state);
+
+  /// @brief Removes `id` from the membership list of `state`.
+  void Leave(Id id, Index state);
+
+  /// @brief Updates the membership of `id` after it transitioned from `from`.
+  void Moved(Id id, Index from);
+
+  /// @brief Processes all members of the state at `I`.
+  template <std::size_t I>
+  void ProcessMembers();
+
+  template <std::size_t... I>
+  void ProcessMembers(std::index_sequence<I...> /* indices */) {
+    (ProcessMembers<I>(), ...);
+  }
+
+  /// @brief Calls `visitor` with the active state of the instance `id`,
+  /// through a compile-time table indexed by its state index.
+  template <typename Visitor>
+  void Dispatch(Id id, Visitor &visitor);
+
+  template <std::size_t I, typename Visitor>
+  static void DispatchTo(StateMachinePool &pool, Id id, Visitor &visitor) {
+    visitor(std::get<I>(pool.states_)[id], id);
+  }
+
+  template <typename Visitor, std::size_t... I>
+  static constexpr auto MakeDispatchTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = void (*)(StateMachinePool &, Id, Visitor &);
+    return std::array<Fn, sizeof...(I)>{&DispatchTo<I, Visitor>...};
+  }
+
+  /// @brief One array per state type, indexed by instance id
+  std::tuple<detail::StateArray<InitialState>, detail::StateArray<States>...>
+      states_;
+
+  /// @brief Index of the active state of every instance
+  std::vector<Index> current_;
+
+  /// @brief Instances per state, only filled for states with Process()
+  std::array<std::vector<Id>, 1 + sizeof...(States)> members_;
+
+  /// @brief Position of every instance within its membership list
+  std::vector<Id> slots_;
+
+  std::vector<Move> deferred_;
+  bool processing_ = false;
+};
+
+// =======================================================================
+// Implementation of StateMachinePool Class
+// =======================================================================
+
+template <typename InitialState, typename... States>
+StateMachinePool<InitialState, States...>::StateMachinePool(
+    std::size_t size, const InitialState &initial_state,
+    const States &...states)
+    : states_{detail::StateArray<InitialState>(size, initial_state),
+              detail::StateArray<States>(size, states)...},
+      current_(size, kIndexOf<InitialState>),
+      slots_(size) {
+  for (Id id = 0; id < size; ++id) {
+    Join(id, kIndexOf<InitialState>);
+  }
+}
+
+template <typename InitialState, typename... States>
+auto StateMachinePool<InitialState, States...>::Add(
+    InitialState initial_state, States... states) -> Id {
+  std::get<kIndexOf<InitialState>>(states_).PushBack(std::move(initial_state));
+  (std::get<kIndexOf<States>>(states_).PushBack(std::move(states)), ...);
+  current_.push_back(kIndexOf<InitialState>);
+  slots_.push_back(0);
+  const auto id = current_.size() - 1;
+  Join(id, kIndexOf<InitialState>);
+  return id;
+}
+
+template <typename InitialState, typename... States>
+void StateMachinePool<InitialState, States...>::Process(Id id) {
+  auto state_visitor = [this](auto &state, Id instance_id) {
+    detail::ProcessInstance(*this, instance_id, state);
+  };
+  Dispatch(id, state_visitor);
+}
+
+template <typename InitialState, typename... States>
+void StateMachinePool<InitialState, States...>::ProcessAll() {
+  processing_ = true;
+  ProcessMembers(std::index_sequence_for<InitialState, States...>{});
+  processing_ = false;
+  // An instance that moved more than once is still listed under the state
+  // of its first move.
+  std::stable_sort(
+      deferred_.begin(), deferred_.end(),
+      [](const Move &lhs, const Move &rhs) { return lhs.id < rhs.id; });
+  for (std::size_t i = 0; i < deferred_.size(); ++i) {
+    const auto &move = deferred_[i];
+    if (i == 0 || deferred_[i - 1].id != move.id) {
+      Leave(move.id, move.from);
+      Join(move.id, current_[move.id]);
+    }
+  }
+  deferred_.clear();
+}
+
+template <typename InitialState, typename... States>
+template <std::size_t I>
+void StateMachinePool<InitialState, States...>::ProcessMembers() {
+  using State = std::tuple_element_t<I, std::tuple<InitialState, States...>>;
+  if constexpr (detail::HasProcess<State>::value) {
+    auto &states = std::get<I>(states_);
+    for (const auto id : members_[I]) {
+      detail::ProcessInstance(*this, id, states[id]);
+    }
+  }
+}
+
+template <typename InitialState, typename... States>
+void StateMachinePool<InitialState, States...>::Join(Id id, Index state) {
+  if (HasProcess(state)) {
+    slots_[id] = members_[state].size();
+    members_[state].push_back(id);
+  }
+}
+
+template <typename InitialState, typename... States>
+void StateMachinePool<InitialState, States...>::Leave(Id id, Index state) {
+  if (HasProcess(state)) {
+    auto &members = members_[state];
+    const auto last = members.back();
+    members[slots_[id]] = last;
+    slots_[last] = slots_[id];
+    members.pop_back();
+  }
+}
+
+template <typename InitialState, typename... States>
+void StateMachinePool<InitialState, States...>::Moved(Id id, Index from) {
+  if (processing_) {
+    deferred_.push_back(Move{id, from});
+  } else {
+    Leave(id, from);
+    Join(id, current_[id]);
+  }
+}
+
+template <typename InitialState, typename... States>
+template <typename Event>
+void StateMachinePool<InitialState, States...>::Handle(Id id,
+                                                       const Event &event) {
+  auto state_visitor = [this, &event](auto &state, Id instance_id) {
+    detail::HandleInstance(*this, instance_id, state, event);
+  };
+  Dispatch(id, state_visitor);
+}
+
+template <typename InitialState, typename... States>
+template <typename Visitor>
+void StateMachinePool<InitialState, States...>::Dispatch(Id id,
+                                                         Visitor &visitor) {
+  static constexpr auto kTable = MakeDispatchTable<Visitor>(
+      std::index_sequence_for<InitialState, States...>{});
+  kTable[current_[id]](*this, id, visitor);
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,54 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_PROBES_H_
+#define VARIADICSTATEMACHINE_PROBES_H_
+
+// Linux USDT probes of the provider `vsm`, a single nop each until a tracer
+// such as perf or bpftrace attaches. They are compiled in whenever
+// <sys/sdt.h> (systemtap-sdt-dev) is available, define VSM_NO_USDT to leave
+// them out.
+//
+//   dispatch_begin(machine, state, event)  before Handle(...) of a state
+//   dispatch_end(machine, state, event)    after it and its transition
+//   transition_exit(machine, from, to)     before the active state is left
+//   transition_enter(machine, from, to)    after the target was entered
+//   process(machine, state)                before Process() of a state
+//
+// `machine` is the address of the state machine, states are leaf indices and
+// `event` is the address of vsm::detail::TypeTag<Event>::kTag, which a tracer
+// resolves to the event type through the symbol table.
+
+#if !defined(VSM_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define VSM_HAS_USDT 1
+#endif
+#endif
+
+#ifdef VSM_HAS_USDT
+#define VSM_PROBE2(name, a, b) DTRACE_PROBE2(vsm, name, a, b)
+#define VSM_PROBE3(name, a, b, c) DTRACE_PROBE3(vsm, name, a, b, c)
+#else
+#define VSM_PROBE2(name, a, b) static_cast<void>(0)
+#define VSM_PROBE3(name, a, b, c) static_cast<void>(0)
+#endif
+
+#endif
@@ -0,0 +1,373 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#ifndef VARIADICSTATEMACHINE_QUEUE_H_
+#define VARIADICSTATEMACHINE_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace vsm {
+
+/// @brief Assumed size of a cache line, used to keep producer and consumer
+/// indices from sharing one.
+inline constexpr std::size_t kCacheLineSize = 64;
+
+/// @brief Bounded lock-free single-producer/single-consumer ring buffer.
+/// @tparam T         The stored element type
+/// @tparam Capacity  The number of elements, must be a power of two
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  SpscQueue() = default;
+  SpscQueue(const SpscQueue &) = delete;
+  auto operator=(const SpscQueue &) -> SpscQueue & = delete;
+  ~SpscQueue();
+
+  /// @brief Constructs an element at the back, producer side only.
+  /// @return false if the queue is full
+  template <typename... Args>
+  auto TryEmplace(Args &&...args) -> bool;
+
+  /// @brief Moves up to `max` elements from the front into `consumer`,
+  /// consumer side only. The freed slots are published once at the end.
+  /// @return The number of consumed elements
+  template <typename Consumer>
+  auto ConsumeAll(Consumer &&consumer, std::size_t max = Capacity)
+      -> std::size_t;
+
+  /// @brief Approximate number of queued elements.
+  [[nodiscard]] auto Size() const -> std::size_t {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr std::size_t kMask = Capacity - 1;
+
+  struct Slot {
+    alignas(T) std::byte storage[sizeof(T)];
+
+    auto Get() -> T & { return *std::launder(reinterpret_cast<T *>(storage)); }
+  };
+
+  /// @brief Consumer position and its cached view of the producer
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};
+  std::size_t cached_tail_{0};
+
+  /// @brief Producer position and its cached view of the consumer
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};
+  std::size_t cached_head_{0};
+
+  alignas(kCacheLineSize) Slot slots_[Capacity];
+};
+
+/// @brief What a producer does if the mailbox is full.
+enum class Overflow {
+  kDrop,             ///< Discard the new event, Post(...) returns false
+  kOverwriteOldest,  ///< Discard the oldest queued event instead
+  kSpin,             ///< Wait until the consumer freed a slot
+};
+
+/// @brief Bounded lock-free multi-producer queue, each slot carries a sequence
+/// number telling producers and consumers whose turn it is. Consuming is safe
+/// from several threads too, which Overflow::kOverwriteOldest relies on.
+/// @tparam T         The stored element type
+/// @tparam Capacity  The number of elements, must be a power of two
+template <typename T, std::size_t Capacity>
+class MpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  MpscQueue();
+  MpscQueue(const MpscQueue &) = delete;
+  auto operator=(const MpscQueue &) -> MpscQueue & = delete;
+  ~MpscQueue();
+
+  /// @brief Constructs an element at the back.
+  /// @return false if the queue is full
+  template <typename... Args>
+  auto TryEmplace(Args &&...args) -> bool;
+
+  /// @brief Moves the front element into `consumer`.
+  /// @return false if the queue is empty
+  template <typename Consumer>
+  auto TryConsume(Consumer &&consumer) -> bool;
+
+  /// @brief Moves up to `max` elements from the front into `consumer`.
+  /// @return The number of consumed elements
+  template <typename Consumer>
+  auto ConsumeAll(Consumer &&consumer, std::size_t max = Capacity)
+      -> std::size_t;
+
+ private:
+  static constexpr std::size_t kMask = Capacity - 1;
+
+  struct Slot {
+    std::atomic<std::size_t> sequence;
+    alignas(T) std::byte storage[sizeof(T)];
+
+    auto Get() -> T & { return *std::launder(reinterpret_cast<T *>(storage)); }
+  };
+
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};
+  alignas(kCacheLineSize) Slot slots_[Capacity];
+};
+
+/// @brief Adapts a state machine with a queue for events posted by one
+/// producer thread, dispatched in run-to-completion order by Drain(...) on the
+/// thread owning the machine.
+/// @tparam Machine   The adapted state machine, e.g. vsm::StateMachine<...>
+/// @tparam Capacity  The number of queued events, must be a power of two
+/// @tparam ...Events The event types that can be posted
+template <typename Machine, std::size_t Capacity, typename... Events>
+class Queued : public Machine {
+ public:
+  using Event = std::variant<Events...>;
+
+  /// @brief Constructs the machine from `args`.
+  template <typename... Args>
+  explicit Queued(Args &&...args) : Machine{std::forward<Args>(args)...} {}
+
+  /// @brief Queues an event, never blocks. Producer side only.
+  /// @return false if the queue is full and the event was dropped
+  template <typename E>
+  auto Post(E &&event) -> bool {
+    return queue_.TryEmplace(std::in_place_type<std::decay_t<E>>,
+                             std::forward<E>(event));
+  }
+
+  /// @brief Dispatches up to `max` queued events to the machine.
+  /// @return The number of dispatched events
+  auto Drain(std::size_t max = Capacity) -> std::size_t {
+    return queue_.ConsumeAll(
+        [this](Event &&event) {
+          std::visit([this](auto &e) { this->Handle(std::move(e)); },
+                     event);
+        },
+        max);
+  }
+
+ private:
+  SpscQueue<Event, Capacity> queue_;
+};
+
+/// @brief Adapts a state machine with a mailbox for events posted by any
+/// number of threads, dispatched in run-to-completion order by Drain(...) on
+/// the thread owning the machine.
+/// @tparam Machine   The adapted state machine, e.g. vsm::StateMachine<...>
+/// @tparam Capacity  The number of queued events, must be a power of two
+/// @tparam kPolicy   What Post(...) does if the mailbox is full
+/// @tparam ...Events The event types that can be posted
+template <typename Machine, std::size_t Capacity, Overflow kPolicy,
+          typename... Events>
+class Mailbox : public Machine {
+ public:
+  using Event = std::variant<Events...>;
+
+  /// @brief Constructs the machine from `args`.
+  template <typename... Args>
+  explicit Mailbox(Args &&...args) : Machine{std::forward<Args>(args)...} {}
+
+  /// @brief Queues an event from any thread, see Overflow for a full mailbox.
+  /// @return false if the event was dropped
+  template <typename E>
+  auto Post(E &&event) -> bool;
+
+  /// @brief Dispatches up to `max` queued events to the machine.
+  /// @return The number of dispatched events
+  auto Drain(std::size_t max = Capacity) -> std::size_t {
+    return queue_.ConsumeAll(
+        [this](Event &&event) {
+          std::visit([this](auto &e) { this->Handle(std::move(e)); },
+                     event);
+        },
+        max);
+  }
+
+ private:
+  MpscQueue<Event, Capacity> queue_;
+};
+
+// =======================================================================
+// Implementation of SpscQueue Class
+// =======================================================================
+
+template <typename T, std::size_t Capacity>
+SpscQueue<T, Capacity>::~SpscQueue() {
+  ConsumeAll([](T && /* element */) {}, Size());
+}
+
+template <typename T, std::size_t Capacity>
+template <typename... Args>
+auto SpscQueue<T, Capacity>::TryEmplace(Args &&...args) -> bool {
+  const auto tail = tail_.load(std::memory_order_relaxed);
+  if (tail - cached_head_ == Capacity) {
+    cached_head_ = head_.load(std::memory_order_acquire);
+    if (tail - cached_head_ == Capacity) {
+      return false;
+    }
+  }
+  new (slots_[tail & kMask].storage) T(std::forward<Args>(args)...);
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T, std::size_t Capacity>
+template <typename Consumer>
+auto SpscQueue<T, Capacity>::ConsumeAll(Consumer &&consumer, std::size_t max)
+    -> std::size_t {
+  const auto head = head_.load(std::memory_order_relaxed);
+  if (cached_tail_ - head < max) {
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+  }
+  const auto available = cached_tail_ - head;
+  const auto count = available < max ? available : max;
+  for (std::size_t i = 0; i < count; ++i) {
+    auto &element = slots_[(head + i) & kMask].Get();
+    consumer(std::move(element));
+    element.~T();
+  }
+  head_.store(head + count, std::memory_order_release);
+  return count;
+}
+
+// =======================================================================
+// Implementation of MpscQueue Class
+// =======================================================================
+
+template <typename T, std::size_t Capacity>
+MpscQueue<T, Capacity>::MpscQueue() {
+  for (std::size_t i = 0; i < Capacity; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <typename T, std::size_t Capacity>
+MpscQueue<T, Capacity>::~MpscQueue() {
+  while (TryConsume([](T && /* element */) {})) {
+  }
+}
+
+template <typename T, std::size_t Capacity>
+template <typename... Args>
+auto MpscQueue<T, Capacity>::TryEmplace(Args &&...args) -> bool {
+  auto pos = tail_.load(std::memory_order_relaxed);
+  Slot *slot = nullptr;
+  while (true) {
+    slot = &slots_[pos & kMask];
+    const auto sequence = slot->sequence.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  new (slot->storage) T(std::forward<Args>(args)...);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T, std::size_t Capacity>
+template <typename Consumer>
+auto MpscQueue<T, Capacity>::TryConsume(Consumer &&consumer) -> bool {
+  auto pos = head_.load(std::memory_order_relaxed);
+  Slot *slot = nullptr;
+  while (true) {
+    slot = &slots_[pos & kMask];
+    const auto sequence = slot->sequence.load(std::memory_order_acquire);
+    const auto diff = static_cast<std::intptr_t>(sequence) -
+                      static_cast<std::intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+  auto &element = slot->Get();
+  consumer(std::move(element));
+  element.~T();
+  slot->sequence.store(pos + Capacity, std::memory_order_release);
+  return true;
+}
+
+template <typename T, std::size_t Capacity>
+template <typename Consumer>
+auto MpscQueue<T, Capacity>::ConsumeAll(Consumer &&consumer, std::size_t max)
+    -> std::size_t {
+  std::size_t count = 0;
+  while (count < max && TryConsume(consumer)) {
+    ++count;
+  }
+  return count;
+}
+
+// =======================================================================
+// Implementation of Mailbox Class
+// =======================================================================
+
+template <typename Machine, std::size_t Capacity, Overflow kPolicy,
+          typename... Events>
+template <typename E>
+auto Mailbox<Machine, Capacity, kPolicy, Events...>::Post(E &&event) -> bool {
+  using Type = std::decay_t<E>;
+  if constexpr (kPolicy == Overflow::kDrop) {
+    return queue_.TryEmplace(std::in_place_type<Type>, std::forward<E>(event));
+  } else {
+    // Retrying needs the event once more, so it is kept until it is queued.
+    Type pending{std::forward<E>(event)};
+    while (!queue_.TryEmplace(std::in_place_type<Type>, std::move(pending))) {
+      if constexpr (kPolicy == Overflow::kOverwriteOldest) {
+        queue_.TryConsume([](Event && /* oldest */) {});
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    return true;
+  }
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,415 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_REGIONS_H_
+#define VARIADICSTATEMACHINE_REGIONS_H_
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+namespace detail {
+
+/// @brief Number of bits needed to store the values [0, n).
+constexpr auto BitWidth(std::size_t n) -> std::size_t {
+  std::size_t bits = 0;
+  while ((std::size_t{1} << bits) < n) {
+    ++bits;
+  }
+  return bits;
+}
+
+template <typename... Sequences>
+struct ConcatIndices {
+  using type = std::index_sequence<>;
+};
+
+template <std::size_t... I>
+struct ConcatIndices<std::index_sequence<I...>> {
+  using type = std::index_sequence<I...>;
+};
+
+template <std::size_t... I, std::size_t... J, typename... Rest>
+struct ConcatIndices<std::index_sequence<I...>, std::index_sequence<J...>,
+                     Rest...>
+    : ConcatIndices<std::index_sequence<I..., J...>, Rest...> {};
+
+}  // namespace detail
+
+template <typename Observer, typename... Regions>
+class BasicOrthogonalStateMachine;
+
+/// @brief One of several concurrently active parts of an
+/// OrthogonalStateMachine. Exactly one of its states is active at any time,
+/// transitions stay within the region.
+/// @tparam InitialState  The state the region begins in
+/// @tparam ...States     The remaining states of the region
+template <typename InitialState, typename... States>
+class Region {
+ public:
+  explicit Region(InitialState initial_state, States... states)
+      : states_{std::move(initial_state), std::move(states)...} {}
+
+ private:
+  template <typename, typename...>
+  friend class BasicOrthogonalStateMachine;
+
+  static constexpr std::size_t kSize = 1 + sizeof...(States);
+
+  template <typename State>
+  static constexpr bool kContains =
+      (std::is_same_v<State, InitialState> ||
+       (std::is_same_v<State, States> || ...));
+
+  template <typename State>
+  static constexpr auto kIndexOf =
+      detail::index_of_v<State, InitialState, States...>;
+
+  /// @brief Whether any state of the region has a Handle(...) for `Event`
+  template <typename Event>
+  static constexpr bool kHandles =
+      (detail::HasHandle<InitialState, const Event &>::value ||
+       (detail::HasHandle<States, const Event &>::value || ...));
+
+  static constexpr bool kProcesses =
+      (detail::HasProcess<InitialState>::value ||
+       (detail::HasProcess<States>::value || ...));
+
+  template <std::size_t I>
+  using StateAt = std::tuple_element_t<I, std::tuple<InitialState, States...>>;
+
+  std::tuple<InitialState, States...> states_;
+};
+
+/// @brief A state machine made of independent regions that are all active at
+/// the same time, e.g. the link and the power state of a device. Events are
+/// handed to every region that has a state handling them, regions that cannot
+/// handle an event type are skipped at compile time.
+///
+/// The active states of all regions are packed into one small integer, each
+/// region owning a fixed bit field. As long as the packed index fits into
+/// kMaxFusedBits, a single table lookup dispatches an event to all regions.
+template <typename Observer, typename... Regions>
+class BasicOrthogonalStateMachine : private Observer {
+ public:
+  /// @brief Tables indexed by the packed state are used up to this many bits,
+  /// larger machines dispatch one region after the other.
+  static constexpr std::size_t kMaxFusedBits = 8;
+
+  /// @brief Constructs a new state machine.
+  /// @param observer The observer receiving the hooks.
+  /// @param regions  The regions, each begins in its initial state.
+  explicit BasicOrthogonalStateMachine(Observer observer, Regions... regions)
+      : Observer{std::move(observer)}, regions_{std::move(regions)...} {}
+
+  /// @brief Calls the initial transition of the initial state of every region.
+  void InitialTransition();
+
+  /// @brief Processes the active state of every region that has a state with
+  /// Process(). Note: Might result in transitions.
+  void Process();
+
+  /// @brief Forwards the event to the active state of every region that has a
+  /// state handling it, states without a matching Handle(...) ignore it.
+  /// Note: Might result in transitions.
+  template <typename Event>
+  void Handle(const Event &event);
+
+  /// @brief Checks if the region containing `State` is currently in it.
+  template <typename State>
+  [[nodiscard]] auto IsInState() const -> bool {
+    constexpr auto kRegion = kRegionOf<State>;
+    static_assert(kRegion < kRegions, "State not part of exactly one region");
+    constexpr auto kValue = static_cast<Index>(
+        RegionAt<kRegion>::template kIndexOf<State> << kShift[kRegion]);
+    return (current_ & kMask[kRegion]) == kValue;
+  }
+
+  /// @brief Returns a specific state from the state machine
+  template <typename State>
+  [[nodiscard]] auto GetState() -> State & {
+    static_assert(kRegionOf<State> < kRegions,
+                  "State not part of exactly one region");
+    return std::get<State>(std::get<kRegionOf<State>>(regions_).states_);
+  }
+
+  /// @brief Returns the observer of this state machine
+  [[nodiscard]] auto GetObserver() -> Observer & { return *this; }
+
+ private:
+  static constexpr std::size_t kRegions = sizeof...(Regions);
+
+  static constexpr std::array<std::size_t, kRegions> kBits{
+      detail::BitWidth(Regions::kSize)...};
+
+  static constexpr auto kShift = [] {
+    std::array<std::size_t, kRegions> shifts{};
+    std::size_t shift = 0;
+    for (std::size_t r = 0; r < kRegions; ++r) {
+      shifts[r] = shift;
+      shift += kBits[r];
+    }
+    return shifts;
+  }();
+
+  static constexpr std::size_t kTotalBits =
+      kShift[kRegions - 1] + kBits[kRegions - 1];
+  static_assert(kTotalBits <= 32, "Too many states to pack into one index");
+
+  using Index = detail::StateIndex<(std::size_t{1} << kTotalBits)>;
+
+  static constexpr auto kMask = [] {
+    std::array<Index, kRegions> masks{};
+    for (std::size_t r = 0; r < kRegions; ++r) {
+      masks[r] = static_cast<Index>(((std::size_t{1} << kBits[r]) - 1)
+                                    << kShift[r]);
+    }
+    return masks;
+  }();
+
+  template <typename State>
+  static constexpr auto kRegionOf = [] {
+    constexpr std::array<bool, kRegions> kContains{
+        Regions::template kContains<State>...};
+    std::size_t region = kRegions;
+    std::size_t count = 0;
+    for (std::size_t r = 0; r < kRegions; ++r) {
+      if (kContains[r]) {
+        region = r;
+        ++count;
+      }
+    }
+    return count == 1 ? region : kRegions;
+  }();
+
+  template <std::size_t R>
+  using RegionAt = std::tuple_element_t<R, std::tuple<Regions...>>;
+
+  /// @brief The regions with a state handling `Event`
+  template <typename Event, std::size_t... R>
+  static auto Handling(std::index_sequence<R...> /* regions */) ->
+      typename detail::ConcatIndices<
+          std::conditional_t<RegionAt<R>::template kHandles<Event>,
+                             std::index_sequence<R>,
+                             std::index_sequence<>>...>::type;
+
+  /// @brief The regions with a state having Process()
+  template <std::size_t... R>
+  static auto Processing(std::index_sequence<R...> /* regions */) ->
+      typename detail::ConcatIndices<
+          std::conditional_t<RegionAt<R>::kProcesses, std::index_sequence<R>,
+                             std::index_sequence<>>...>::type;
+
+  /// @brief The state machine of a single region as seen by transitions.
+  template <std::size_t R>
+  class RegionView {
+   public:
+    explicit RegionView(BasicOrthogonalStateMachine &machine)
+        : machine_{machine} {}
+
+    [[nodiscard]] auto GetObserver() -> Observer & {
+      return machine_.GetObserver();
+    }
+
+   private:
+    template <typename, typename>
+    friend struct vsm::TransitionTo;
+
+    template <typename From, typename To, typename ExitFn, typename EnterFn,
+              typename... Args>
+    void Transition(ExitFn &&exit, EnterFn &&enter, Args &&.../* args */) {
+      static_assert(RegionAt<R>::template kContains<To>,
+                    "Invalid state transition: State not part of region");
+      exit(machine_.template GetState<From>());
+      constexpr auto kValue = static_cast<Index>(
+          RegionAt<R>::template kIndexOf<To> << kShift[R]);
+      machine_.current_ =
+          static_cast<Index>((machine_.current_ & ~kMask[R]) | kValue);
+      enter(machine_.template GetState<To>());
+    }
+
+    BasicOrthogonalStateMachine &machine_;
+  };
+
+  /// @brief The active state index of region `R` within `packed`
+  template <std::size_t R>
+  static constexpr auto Field(std::size_t packed) -> std::size_t {
+    return (packed & kMask[R]) >> kShift[R];
+  }
+
+  /// @brief Calls `visitor(region, state)` with the active state of each of
+  /// the regions `R...`, both as std::integral_constant.
+  template <typename Visitor, std::size_t... R>
+  void Dispatch(Visitor &visitor, std::index_sequence<R...> regions);
+
+  template <typename Visitor, std::size_t Packed, std::size_t... R>
+  static void DispatchFused(Visitor &visitor) {
+    (DispatchTo<R, Field<R>(Packed)>(visitor), ...);
+  }
+
+  /// @brief Calls `visitor` for the active state of region `R` only, used if
+  /// the packed index is too large for a fused table. A transition only
+  /// changes the field of its own region.
+  template <std::size_t R, typename Visitor>
+  void DispatchRegion(Visitor &visitor);
+
+  template <std::size_t R, std::size_t I, typename Visitor>
+  static void DispatchTo(Visitor &visitor) {
+    // Bit patterns past the region's last state never occur.
+    if constexpr (I < RegionAt<R>::kSize) {
+      visitor(std::integral_constant<std::size_t, R>{},
+              std::integral_constant<std::size_t, I>{});
+    }
+  }
+
+  template <typename Visitor, std::size_t... R, std::size_t... Packed>
+  static constexpr auto MakeFusedTable(
+      std::index_sequence<R...> /* regions */,
+      std::index_sequence<Packed...> /* packed */) {
+    // Only the fields of the visited regions select the entry, all other bits
+    // map to the same function.
+    constexpr auto kVisited = static_cast<std::size_t>((kMask[R] | ... | 0));
+    using Fn = void (*)(Visitor &);
+    return std::array<Fn, sizeof...(Packed)>{
+        &DispatchFused<Visitor, (Packed & kVisited), R...>...};
+  }
+
+  template <std::size_t R, typename Visitor, std::size_t... I>
+  static constexpr auto MakeRegionTable(std::index_sequence<I...> /* idx */) {
+    using Fn = void (*)(Visitor &);
+    return std::array<Fn, sizeof...(I)>{&DispatchTo<R, I, Visitor>...};
+  }
+
+  /// @brief Forwards the event to the active state `I` of region `R`.
+  template <std::size_t R, std::size_t I, typename Event>
+  void HandleIn(const Event &event);
+
+  std::tuple<Regions...> regions_;
+
+  /// @brief The packed index of the active state of every region
+  Index current_{0};
+};
+
+/// @brief An orthogonal state machine without an observer.
+template <typename... Regions>
+class OrthogonalStateMachine
+    : public BasicOrthogonalStateMachine<NoObserver, Regions...> {
+ public:
+  /// @brief Constructs a new state machine.
+  /// @param regions  The regions, each begins in its initial state.
+  explicit OrthogonalStateMachine(Regions... regions)
+      : BasicOrthogonalStateMachine<NoObserver, Regions...>{
+            NoObserver{}, std::move(regions)...} {}
+};
+
+// =======================================================================
+// Implementation of BasicOrthogonalStateMachine Class
+// =======================================================================
+
+template <typename Observer, typename... Regions>
+void BasicOrthogonalStateMachine<Observer, Regions...>::InitialTransition() {
+  auto enter = [this](auto &state) {
+    using State = std::remove_reference_t<decltype(state)>;
+    GetObserver().template OnInitialTransition<State>();
+    if constexpr (detail::HasOnEnter<decltype(state)>::value) {
+      state.OnEnter();
+    }
+  };
+  std::apply(
+      [&enter](auto &...region) { (enter(std::get<0>(region.states_)), ...); },
+      regions_);
+}
+
+template <typename Observer, typename... Regions>
+void BasicOrthogonalStateMachine<Observer, Regions...>::Process() {
+  auto state_visitor = [this](auto region, auto index) {
+    constexpr auto kRegion = decltype(region)::value;
+    constexpr auto kIndex = decltype(index)::value;
+    using State = typename RegionAt<kRegion>::template StateAt<kIndex>;
+    if constexpr (detail::HasProcess<State>::value) {
+      auto &state = std::get<kIndex>(std::get<kRegion>(regions_).states_);
+      RegionView<kRegion> view{*this};
+      state.Process().Execute(view, state);
+    }
+  };
+  Dispatch(state_visitor,
+           decltype(Processing(std::index_sequence_for<Regions...>{})){});
+}
+
+template <typename Observer, typename... Regions>
+template <typename Event>
+void BasicOrthogonalStateMachine<Observer, Regions...>::Handle(
+    const Event &event) {
+  auto state_visitor = [this, &event](auto region, auto index) {
+    HandleIn<decltype(region)::value, decltype(index)::value>(event);
+  };
+  Dispatch(state_visitor,
+           decltype(Handling<Event>(std::index_sequence_for<Regions...>{})){});
+}
+
+template <typename Observer, typename... Regions>
+template <std::size_t R, std::size_t I, typename Event>
+void BasicOrthogonalStateMachine<Observer, Regions...>::HandleIn(
+    const Event &event) {
+  using State = typename RegionAt<R>::template StateAt<I>;
+  if constexpr (detail::HasHandle<State, const Event &>::value) {
+    auto &state = std::get<I>(std::get<R>(regions_).states_);
+    GetObserver().template OnEventDispatched<State>(event);
+    detail::EventHandledGuard<State, Event, Observer> handled{GetObserver()};
+    RegionView<R> view{*this};
+    state.Handle(event).Execute(view, state, event);
+  } else {
+    GetObserver().template OnUnhandled<State>(event);
+  }
+}
+
+template <typename Observer, typename... Regions>
+template <typename Visitor, std::size_t... R>
+void BasicOrthogonalStateMachine<Observer, Regions...>::Dispatch(
+    Visitor &visitor, std::index_sequence<R...> regions) {
+  if constexpr (sizeof...(R) == 0) {
+    // No region can react, nothing to look up.
+  } else if constexpr (kTotalBits <= kMaxFusedBits) {
+    static constexpr auto kTable = MakeFusedTable<Visitor>(
+        regions, std::make_index_sequence<std::size_t{1} << kTotalBits>{});
+    kTable[current_](visitor);
+  } else {
+    (DispatchRegion<R>(visitor), ...);
+  }
+}
+
+template <typename Observer, typename... Regions>
+template <std::size_t R, typename Visitor>
+void BasicOrthogonalStateMachine<Observer, Regions...>::DispatchRegion(
+    Visitor &visitor) {
+  static constexpr auto kTable = MakeRegionTable<R, Visitor>(
+      std::make_index_sequence<RegionAt<R>::kSize>{});
+  kTable[Field<R>(current_)](visitor);
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,344 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_REPLAY_H_
+#define VARIADICSTATEMACHINE_REPLAY_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief Layout of an event log over `Events...`. After a header every
+/// record has the same width: the index of the event type in `Events...`,
+/// or kTick for a Process() call, followed by the raw bytes of trivially
+/// copyable events. Other events are recorded by type only and replayed
+/// default constructed.
+template <typename... Events>
+struct EventLogFormat {
+  static_assert(((std::is_trivially_copyable_v<Events> ||
+                  std::is_default_constructible_v<Events>) &&
+                 ...),
+                "Logged events must be trivially copyable or default "
+                "constructible");
+
+  static constexpr std::uint32_t kVersion = 1;
+  static constexpr std::uint32_t kTick = sizeof...(Events);
+
+  template <typename Event>
+  static constexpr bool kHasPayload =
+      std::is_trivially_copyable_v<Event> && !std::is_empty_v<Event>;
+
+  static constexpr std::size_t kPayloadSize = [] {
+    std::size_t size = 0;
+    ((size = std::max(size, kHasPayload<Events> ? sizeof(Events) : 0)), ...);
+    return (size + 7) / 8 * 8;
+  }();
+
+  static constexpr std::size_t kRecordSize = 8 + kPayloadSize;
+
+  /// @brief Rejects logs of other event lists
+  static constexpr std::uint64_t kHash =
+      detail::SnapshotLayoutHash<Events...>();
+
+  struct Header {
+    std::array<char, 4> magic;
+    std::uint32_t version;
+    std::uint64_t hash;
+    std::uint64_t record_size;
+  };
+
+  static constexpr std::array<char, 4> kMagic{'V', 'S', 'M', 'R'};
+
+  /// @brief Writes the type and payload of `event` into `record`, which is
+  /// kRecordSize bytes wide.
+  template <typename Event>
+  static void Encode(const Event &event, std::byte *record) {
+    constexpr auto kType = detail::index_of_v<Event, Events...>;
+    static_assert(kType < sizeof...(Events), "Event is not recorded");
+    EncodeType(kType, record);
+    if constexpr (kHasPayload<Event>) {
+      std::memcpy(record + 8, &event, sizeof(Event));
+    }
+  }
+
+  /// @brief Writes a record without payload of `type` into `record`.
+  static void EncodeType(std::uint32_t type, std::byte *record) {
+    std::memcpy(record, &type, sizeof(type));
+    std::memset(record + sizeof(type), 0, kRecordSize - sizeof(type));
+  }
+
+  /// @brief Feeds the record at `record` into `machine`, Handle(...) for an
+  /// event and Process() for a tick.
+  /// @return False if the record holds no known type
+  template <typename Machine>
+  static auto Apply(Machine &machine, const std::byte *record) -> bool {
+    static constexpr auto kTable =
+        MakeApplyTable<Machine>(std::index_sequence_for<Events...>{});
+    std::uint32_t type = 0;
+    std::memcpy(&type, record, sizeof(type));
+    if (type > kTick) {
+      return false;
+    }
+    kTable[type](machine, record + 8);
+    return true;
+  }
+
+ private:
+  template <std::size_t I, typename Machine>
+  static void ApplyOne(Machine &machine, const std::byte *payload) {
+    using Event = std::tuple_element_t<I, std::tuple<Events...>>;
+    if constexpr (kHasPayload<Event>) {
+      alignas(Event) std::byte raw[sizeof(Event)];
+      std::memcpy(raw, payload, sizeof(Event));
+      auto &event = *std::launder(reinterpret_cast<Event *>(raw));
+      machine.Handle(std::move(event));
+    } else {
+      machine.Handle(Event{});
+    }
+  }
+
+  template <typename Machine>
+  static void ApplyTick(Machine &machine, const std::byte * /* payload */) {
+    machine.Process();
+  }
+
+  template <typename Machine, std::size_t... I>
+  static constexpr auto MakeApplyTable(std::index_sequence<I...> /* idx */) {
+    using Fn = void (*)(Machine &, const std::byte *);
+    return std::array<Fn, sizeof...(I) + 1>{&ApplyOne<I, Machine>...,
+                                             &ApplyTick<Machine>};
+  }
+};
+
+/// @brief Adapts a state machine to append every handled event and every
+/// Process() call to a binary event log, see EventLogFormat. The log is
+/// written before the machine acts. Records are buffered and reach the
+/// stream in blocks, on Flush() and when the adapter is destroyed.
+/// Only Handle(...), HandleBatch(...) and Process() of the adapter are
+/// recorded: timeouts and the queue of a Queued or Mailbox wrapped by the
+/// adapter dispatch to the machine directly, wrap the adapter in the queue
+/// instead.
+/// @tparam Machine   The adapted state machine, e.g. vsm::StateMachine<...>
+/// @tparam ...Events The event types that can be recorded
+template <typename Machine, typename... Events>
+class Recorded : public Machine {
+ public:
+  using Format = EventLogFormat<Events...>;
+
+  /// @brief Constructs the machine from `args` and writes the log header.
+  template <typename... Args>
+  explicit Recorded(std::ostream &log, Args &&...args)
+      : Machine{std::forward<Args>(args)...}, log_{&log} {
+    const typename Format::Header header{Format::kMagic, Format::kVersion,
+                                         Format::kHash, Format::kRecordSize};
+    log_->write(reinterpret_cast<const char *>(&header), sizeof(header));
+  }
+
+  Recorded(const Recorded &) = delete;
+  auto operator=(const Recorded &) = delete;
+
+  ~Recorded() { Flush(); }
+
+  /// @brief Records `event`, then forwards it to the machine.
+  template <typename Event>
+  void Handle(Event &&event) {
+    Format::Encode(event, Append());
+    Machine::Handle(std::forward<Event>(event));
+  }
+
+  /// @brief Records and handles `n` events starting at `first` one by one.
+  template <typename Event>
+  void HandleBatch(const Event *first, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      Handle(first[i]);
+    }
+  }
+
+  /// @brief Records and handles `n` events of different types starting at
+  /// `first` one by one.
+  template <typename... Variants>
+  void HandleBatch(const std::variant<Variants...> *first, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      std::visit([this](const auto &event) { Handle(event); }, first[i]);
+    }
+  }
+
+  /// @brief Records a tick, then processes the machine.
+  void Process() {
+    Format::EncodeType(Format::kTick, Append());
+    Machine::Process();
+  }
+
+  /// @brief Writes the buffered records to the stream and flushes it.
+  void Flush() {
+    log_->write(reinterpret_cast<const char *>(buffer_.data()),
+                static_cast<std::streamsize>(used_));
+    used_ = 0;
+    log_->flush();
+  }
+
+ private:
+  static constexpr std::size_t kBufferRecords = 1024;
+
+  /// @brief The next free record of the buffer.
+  auto Append() -> std::byte * {
+    if (used_ == buffer_.size()) {
+      log_->write(reinterpret_cast<const char *>(buffer_.data()),
+                  static_cast<std::streamsize>(used_));
+      used_ = 0;
+    }
+    auto *record = buffer_.data() + used_;
+    used_ += Format::kRecordSize;
+    return record;
+  }
+
+  std::ostream *log_;
+  std::array<std::byte, kBufferRecords * Format::kRecordSize> buffer_;
+  std::size_t used_ = 0;
+};
+
+/// @brief Replays an event log written by Recorded into a machine, as fast
+/// as the machine handles the events. The log is mapped read-only.
+/// POSIX only.
+/// @tparam ...Events The event types of the log, as given to Recorded
+template <typename... Events>
+class EventLogReplayer {
+ public:
+  using Format = EventLogFormat<Events...>;
+
+  /// @brief Maps the log at `path`.
+  /// @return Nothing if it cannot be mapped or is not a log of `Events...`
+  static auto Open(const char *path) -> std::optional<EventLogReplayer>;
+
+  EventLogReplayer(EventLogReplayer &&other) noexcept
+      : map_{std::exchange(other.map_, nullptr)},
+        size_{std::exchange(other.size_, 0)} {}
+
+  auto operator=(EventLogReplayer &&other) noexcept -> EventLogReplayer & {
+    std::swap(map_, other.map_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+
+  EventLogReplayer(const EventLogReplayer &) = delete;
+  auto operator=(const EventLogReplayer &) = delete;
+
+  ~EventLogReplayer() {
+    if (map_ != nullptr) {
+      munmap(map_, size_);
+    }
+  }
+
+  /// @brief The number of complete records in the log.
+  [[nodiscard]] auto Size() const -> std::size_t {
+    return (size_ - sizeof(typename Format::Header)) / Format::kRecordSize;
+  }
+
+  /// @brief Feeds up to `count` records starting at `first` into `machine`.
+  /// @return The number of replayed records
+  template <typename Machine>
+  auto Replay(Machine &machine, std::size_t first = 0,
+              std::size_t count = kAll) const -> std::size_t;
+
+  static constexpr std::size_t kAll = std::numeric_limits<std::size_t>::max();
+
+ private:
+  EventLogReplayer(void *map, std::size_t size) : map_{map}, size_{size} {}
+
+  void *map_;
+  std::size_t size_;
+};
+
+// =======================================================================
+// Implementation of EventLogReplayer Class
+// =======================================================================
+
+template <typename... Events>
+auto EventLogReplayer<Events...>::Open(const char *path)
+    -> std::optional<EventLogReplayer> {
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0 ||
+      static_cast<std::size_t>(info.st_size) <
+          sizeof(typename Format::Header)) {
+    ::close(fd);
+    return std::nullopt;
+  }
+  const auto size = static_cast<std::size_t>(info.st_size);
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return std::nullopt;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(map, size, MADV_SEQUENTIAL);
+#endif
+  EventLogReplayer replayer{map, size};
+  typename Format::Header header{};
+  std::memcpy(&header, map, sizeof(header));
+  if (header.magic != Format::kMagic || header.version != Format::kVersion ||
+      header.hash != Format::kHash ||
+      header.record_size != Format::kRecordSize) {
+    return std::nullopt;
+  }
+  return replayer;
+}
+
+template <typename... Events>
+template <typename Machine>
+auto EventLogReplayer<Events...>::Replay(Machine &machine, std::size_t first,
+                                         std::size_t count) const
+    -> std::size_t {
+  const auto end = first + std::min(count, Size() - std::min(first, Size()));
+  const auto *records = static_cast<const std::byte *>(map_) +
+                        sizeof(typename Format::Header);
+  for (auto i = first; i < end; ++i) {
+    if (!Format::Apply(machine, records + i * Format::kRecordSize)) {
+      return i - first;
+    }
+  }
+  return end - first;
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,356 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#ifndef VARIADICSTATEMACHINE_TIMER_H_
+#define VARIADICSTATEMACHINE_TIMER_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief The event a state receives when its timeout `Tag` expires.
+template <typename Tag>
+struct Timeout {};
+
+class TimerWheel;
+
+/// @brief A timer that is linked into a TimerWheel while armed. It is owned
+/// by its user, usually a state, so arming and cancelling never allocate.
+/// Copies are unarmed, a timer cancels itself when destroyed.
+class Timer {
+ public:
+  using Callback = void (*)(void *context);
+
+  Timer() = default;
+  Timer(const Timer & /* other */) noexcept {}
+  auto operator=(const Timer & /* other */) noexcept -> Timer & {
+    return *this;
+  }
+  ~Timer() { Cancel(); }
+
+  /// @brief Sets the function called with `context` when the timer fires.
+  void SetCallback(Callback callback, void *context) {
+    callback_ = callback;
+    context_ = context;
+  }
+
+  [[nodiscard]] auto Armed() const -> bool { return pprev_ != nullptr; }
+
+  /// @brief Unlinks the timer from its wheel in constant time.
+  void Cancel();
+
+ private:
+  friend class TimerWheel;
+
+  Timer *next_ = nullptr;
+  Timer **pprev_ = nullptr;
+  TimerWheel *wheel_ = nullptr;
+  std::uint64_t deadline_ = 0;
+  Callback callback_ = nullptr;
+  void *context_ = nullptr;
+  std::uint8_t level_ = 0;
+};
+
+/// @brief Hierarchical timing wheel of kLevels levels with kSlots slots
+/// each. A timer is placed into the level whose range covers its delay and
+/// moves one level down whenever the wheel passes that level's slot, so
+/// arming and cancelling take constant time and advancing costs one step
+/// per tick plus the fired timers. Ticks without timers due are skipped.
+/// Timers further away than kLevels levels cover wait in the last level
+/// until they are in range.
+///
+/// Not thread-safe, the wheel is advanced by the thread owning the armed
+/// timers and their machines.
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr unsigned kSlotBits = 8;
+  static constexpr std::size_t kSlots = std::size_t{1} << kSlotBits;
+  static constexpr std::size_t kLevels = 4;
+
+  /// @brief Constructs an empty wheel whose tick 0 is `start`.
+  /// @param resolution The length of a tick, every delay is rounded up to it
+  explicit TimerWheel(
+      Clock::duration resolution = std::chrono::milliseconds{1},
+      Clock::time_point start = Clock::now())
+      : resolution_{resolution}, start_{start} {}
+
+  TimerWheel(const TimerWheel &) = delete;
+  auto operator=(const TimerWheel &) = delete;
+
+  ~TimerWheel();
+
+  /// @brief Arms `timer` to fire `delay` after the tick reached by the last
+  /// Advance(...), but at least one tick later. An armed timer is re-armed.
+  void Arm(Timer &timer, Clock::duration delay);
+
+  /// @brief Fires every timer due by `now`, in the order of their ticks.
+  /// Callbacks may arm and cancel timers.
+  /// @return The number of fired timers
+  auto Advance(Clock::time_point now) -> std::size_t;
+
+  /// @brief The number of armed timers.
+  [[nodiscard]] auto Size() const -> std::size_t {
+    std::size_t size = 0;
+    for (const auto level : level_sizes_) {
+      size += level;
+    }
+    return size;
+  }
+
+  /// @brief The tick reached by the last Advance(...).
+  [[nodiscard]] auto Now() const -> std::uint64_t { return now_; }
+
+ private:
+  friend class Timer;
+
+  /// @brief Links `timer` into the slot of its deadline.
+  void Insert(Timer &timer);
+
+  void Unlink(Timer &timer) {
+    *timer.pprev_ = timer.next_;
+    if (timer.next_ != nullptr) {
+      timer.next_->pprev_ = timer.pprev_;
+    }
+    timer.next_ = nullptr;
+    timer.pprev_ = nullptr;
+    level_sizes_[timer.level_]--;
+  }
+
+  /// @brief Moves the timers of a slot of `level` into lower levels.
+  void Cascade(std::size_t level, std::size_t slot);
+
+  /// @brief Fires the timers of the current tick.
+  auto Expire() -> std::size_t;
+
+  std::array<std::array<Timer *, kSlots>, kLevels> slots_{};
+  std::array<std::size_t, kLevels> level_sizes_{};
+  Clock::duration resolution_;
+  Clock::time_point start_;
+  std::uint64_t now_ = 0;
+};
+
+/// @brief Base of a state with the timeouts `Tags...`. ArmTimeout<Tag>(...),
+/// usually called from OnEnter(...), makes the machine Handle(...) a
+/// Timeout<Tag> once the delay passed, and leaving the state cancels all of
+/// its timeouts. Supported by BasicStateMachine and the machines built on
+/// it. The timeouts are delivered to that machine, not to adapters around
+/// it, and the machine must not be moved while one is armed.
+/// @tparam ...Tags Distinguish the timeouts of a state, e.g. the state itself
+template <typename... Tags>
+class Timeouts {
+ public:
+  explicit Timeouts(TimerWheel &wheel) : wheel_{&wheel} {}
+
+  /// @brief Arms the timeout `Tag` to expire after `delay`, see
+  /// TimerWheel::Arm.
+  template <typename Tag>
+  void ArmTimeout(TimerWheel::Clock::duration delay) {
+    wheel_->Arm(timers_[kIndexOf<Tag>], delay);
+  }
+
+  template <typename Tag>
+  void CancelTimeout() {
+    timers_[kIndexOf<Tag>].Cancel();
+  }
+
+  template <typename Tag>
+  [[nodiscard]] auto TimeoutArmed() const -> bool {
+    return timers_[kIndexOf<Tag>].Armed();
+  }
+
+  /// @brief Directs the timeouts to `machine`, called by the machine before
+  /// the state is entered.
+  template <typename Machine>
+  void BindTimeouts(Machine &machine) {
+    BindTimeouts(machine, std::index_sequence_for<Tags...>{});
+  }
+
+  /// @brief Cancels every timeout, called by the machine when the state is
+  /// left.
+  void CancelTimeouts() {
+    for (auto &timer : timers_) {
+      timer.Cancel();
+    }
+  }
+
+ private:
+  template <typename Tag>
+  static constexpr std::size_t kIndexOf = [] {
+    constexpr auto kIndex = detail::index_of_v<Tag, Tags...>;
+    static_assert(kIndex < sizeof...(Tags), "Not a timeout of this state");
+    return kIndex;
+  }();
+
+  template <typename Machine, typename Tag>
+  static void Deliver(void *machine) {
+    static_cast<Machine *>(machine)->Handle(Timeout<Tag>{});
+  }
+
+  template <typename Machine, std::size_t... I>
+  void BindTimeouts(Machine &machine, std::index_sequence<I...> /* idx */) {
+    (timers_[I].SetCallback(&Deliver<Machine, Tags>, &machine), ...);
+  }
+
+  TimerWheel *wheel_;
+  std::array<Timer, sizeof...(Tags)> timers_;
+};
+
+// =======================================================================
+// Implementation of Timer Class
+// =======================================================================
+
+inline void Timer::Cancel() {
+  if (pprev_ != nullptr) {
+    wheel_->Unlink(*this);
+  }
+}
+
+// =======================================================================
+// Implementation of TimerWheel Class
+// =======================================================================
+
+inline TimerWheel::~TimerWheel() {
+  for (auto &level : slots_) {
+    for (auto *timer : level) {
+      while (timer != nullptr) {
+        auto *next = timer->next_;
+        timer->next_ = nullptr;
+        timer->pprev_ = nullptr;
+        timer = next;
+      }
+    }
+  }
+}
+
+inline void TimerWheel::Arm(Timer &timer, Clock::duration delay) {
+  timer.Cancel();
+  const auto ticks =
+      delay.count() <= 0
+          ? 0
+          : static_cast<std::uint64_t>((delay.count() - 1) /
+                                       resolution_.count()) +
+                1;
+  timer.wheel_ = this;
+  timer.deadline_ = now_ + std::max<std::uint64_t>(ticks, 1);
+  Insert(timer);
+}
+
+inline void TimerWheel::Insert(Timer &timer) {
+  const auto delta = timer.deadline_ - now_;
+  std::size_t level = 0;
+  while (level + 1 < kLevels && (delta >> (kSlotBits * (level + 1))) != 0) {
+    ++level;
+  }
+  auto position = timer.deadline_;
+  constexpr auto kRange = std::uint64_t{1} << (kSlotBits * kLevels);
+  if (delta >= kRange) {
+    // Cascaded again before it is due, then placed by its real deadline.
+    position = now_ + kRange - 1;
+  }
+  auto &head = slots_[level][(position >> (kSlotBits * level)) & (kSlots - 1)];
+  timer.next_ = head;
+  if (head != nullptr) {
+    head->pprev_ = &timer.next_;
+  }
+  head = &timer;
+  timer.pprev_ = &head;
+  timer.level_ = static_cast<std::uint8_t>(level);
+  level_sizes_[level]++;
+}
+
+inline void TimerWheel::Cascade(std::size_t level, std::size_t slot) {
+  auto *timer = std::exchange(slots_[level][slot], nullptr);
+  while (timer != nullptr) {
+    auto *next = timer->next_;
+    level_sizes_[level]--;
+    Insert(*timer);
+    timer = next;
+  }
+}
+
+inline auto TimerWheel::Expire() -> std::size_t {
+  // Detached first, callbacks may cancel the timers still waiting here.
+  Timer *due = std::exchange(slots_[0][now_ & (kSlots - 1)], nullptr);
+  if (due != nullptr) {
+    due->pprev_ = &due;
+  }
+  std::size_t fired = 0;
+  while (due != nullptr) {
+    auto &timer = *due;
+    Unlink(timer);
+    ++fired;
+    if (timer.callback_ != nullptr) {
+      timer.callback_(timer.context_);
+    }
+  }
+  return fired;
+}
+
+inline auto TimerWheel::Advance(Clock::time_point now) -> std::size_t {
+  const auto target =
+      now <= start_ ? now_
+                    : std::max<std::uint64_t>(
+                          now_, static_cast<std::uint64_t>(
+                                    (now - start_) / resolution_));
+  std::size_t fired = 0;
+  while (now_ < target) {
+    // Levels below the first occupied one have nothing to do until the
+    // wheel reaches the next slot of that level.
+    std::size_t occupied = 0;
+    while (occupied < kLevels && level_sizes_[occupied] == 0) {
+      ++occupied;
+    }
+    if (occupied == kLevels) {
+      now_ = target;
+      break;
+    }
+    if (occupied > 0) {
+      const auto skip = (std::uint64_t{1} << (kSlotBits * occupied)) - 1;
+      now_ = std::min(target, now_ | skip);
+      if (now_ == target) {
+        break;
+      }
+    }
+    ++now_;
+    for (std::size_t level = 1; level < kLevels; ++level) {
+      const auto shift = kSlotBits * level;
+      if ((now_ & ((std::uint64_t{1} << shift) - 1)) != 0) {
+        break;
+      }
+      Cascade(level, (now_ >> shift) & (kSlots - 1));
+    }
+    fired += Expire();
+  }
+  return fired;
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,359 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_TRACE_H_
+#define VARIADICSTATEMACHINE_TRACE_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vsm/clock.hpp"
+#include "vsm/vsm.hpp"
+
+#ifndef VSM_TRACE_CAPACITY
+/// @brief Records kept per thread before the oldest are overwritten, must be
+/// a power of two.
+#define VSM_TRACE_CAPACITY 16384
+#endif
+
+namespace vsm {
+
+/// @brief A single fixed-size trace entry. States and events are stored as
+/// indices into the name table of the TraceRegistry.
+struct TraceRecord {
+  enum class Kind : std::uint16_t { kTransition, kDispatch };
+
+  static constexpr std::uint16_t kNoEvent = 0xFFFF;
+
+  std::uint64_t timestamp;
+  std::uint32_t machine;
+  std::uint32_t thread;
+  std::uint16_t from;
+  std::uint16_t to;
+  std::uint16_t event;
+  Kind kind;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord must not be padded");
+
+/// @brief Single-producer ring of trace records owned by one thread. The
+/// producer never blocks, when full the oldest records are overwritten.
+class TraceRing {
+ public:
+  static constexpr std::size_t kCapacity = VSM_TRACE_CAPACITY;
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "VSM_TRACE_CAPACITY must be a power of two");
+
+  explicit TraceRing(std::uint32_t thread) : thread_{thread} {}
+
+  /// @brief Appends a record, only called by the owning thread.
+  void Push(TraceRecord record) {
+    const auto head = head_.load(std::memory_order_relaxed);
+    record.thread = thread_;
+    std::array<std::uint64_t, kWords> words{};
+    std::memcpy(words.data(), &record, sizeof(record));
+    auto &slot = slots_[head & (kCapacity - 1)];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < kWords; ++i) {
+      slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(head + 1, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  /// @brief Appends the retained records, oldest first. May be called from
+  /// any thread, records the owning thread overwrites meanwhile are dropped.
+  void Collect(std::vector<TraceRecord> &out) const;
+
+ private:
+  static constexpr std::size_t kWords = sizeof(TraceRecord) / 8;
+
+  /// @brief A record and the position it was pushed at plus one, or 0 while
+  /// it is written. A reader keeps the record only if the position is the
+  /// expected one before and after copying it.
+  struct Slot {
+    std::atomic<std::uint64_t> sequence{0};
+    std::array<std::atomic<std::uint64_t>, kWords> words{};
+  };
+
+  std::array<Slot, kCapacity> slots_{};
+  std::atomic<std::uint64_t> head_{0};
+  std::uint32_t thread_;
+};
+
+/// @brief Process-wide table of the traced type names and the rings of all
+/// threads that traced. Rings outlive their threads so their records can
+/// still be collected.
+class TraceRegistry {
+ public:
+  [[nodiscard]] static auto Instance() -> TraceRegistry & {
+    static TraceRegistry registry;
+    return registry;
+  }
+
+  /// @brief The index of `T` in the name table, registered on first use.
+  template <typename T>
+  [[nodiscard]] static auto IndexOf() -> std::uint16_t {
+    static const std::uint16_t kIndex = Instance().Register(NameOf<T>());
+    return kIndex;
+  }
+
+  /// @brief The ring of the calling thread.
+  [[nodiscard]] static auto LocalRing() -> TraceRing & {
+    thread_local TraceRing &ring = Instance().AddRing();
+    return ring;
+  }
+
+  /// @brief The records of all threads, oldest first per thread.
+  [[nodiscard]] auto Collect() -> std::vector<TraceRecord>;
+
+  /// @brief The registered names, indexed by TraceRecord::from, to and event.
+  [[nodiscard]] auto Names() -> std::vector<std::string>;
+
+ private:
+  TraceRegistry() = default;
+
+  template <typename T>
+  static auto NameOf() -> std::string_view {
+    if constexpr (detail::HasName<T>::value) {
+      return T::Name();
+    } else {
+      return {};
+    }
+  }
+
+  auto Register(std::string_view name) -> std::uint16_t;
+  auto AddRing() -> TraceRing &;
+
+  std::mutex mutex_;
+  std::vector<std::string> names_;
+  std::vector<std::unique_ptr<TraceRing>> rings_;
+};
+
+/// @brief Observer writing a binary record for every transition and
+/// dispatched event into the ring of the calling thread.
+class TraceObserver : public NoObserver {
+ public:
+  /// @param machine  Identifies the traced machine in the records
+  explicit TraceObserver(std::uint32_t machine = 0) : machine_{machine} {}
+
+  template <typename From, typename To, typename... Event>
+  void OnTransition(const Event &.../* event */) {
+    Record<From, To, Event...>(TraceRecord::Kind::kTransition);
+  }
+
+  template <typename State, typename Event>
+  void OnEventDispatched(const Event & /* event */) {
+    Record<State, State, Event>(TraceRecord::Kind::kDispatch);
+  }
+
+ private:
+  template <typename From, typename To, typename... Event>
+  void Record(TraceRecord::Kind kind) {
+    std::uint16_t event = TraceRecord::kNoEvent;
+    if constexpr (sizeof...(Event) == 1) {
+      event = TraceRegistry::IndexOf<Event...>();
+    }
+    TraceRegistry::LocalRing().Push(TraceRecord{
+        TickClock::Now(), machine_, 0, TraceRegistry::IndexOf<From>(),
+        TraceRegistry::IndexOf<To>(), event, kind});
+  }
+
+  std::uint32_t machine_;
+};
+
+/// @brief A trace as written by WriteTrace, with everything needed to decode
+/// it offline.
+struct Trace {
+  double ticks_per_us = 1.0;
+  std::vector<std::string> names;
+  std::vector<TraceRecord> records;
+};
+
+/// @brief Collects the records of all threads into a Trace.
+[[nodiscard]] inline auto CollectTrace() -> Trace {
+  auto &registry = TraceRegistry::Instance();
+  return Trace{TickClock::TicksPerMicrosecond(), registry.Names(),
+               registry.Collect()};
+}
+
+/// @brief Writes `trace` in the binary trace format, in host byte order.
+inline void WriteTrace(std::ostream &out, const Trace &trace);
+
+/// @brief Reads a trace written by WriteTrace.
+/// @return false if the input is not a valid trace
+inline auto ReadTrace(std::istream &in, Trace &trace) -> bool;
+
+// =======================================================================
+// Implementation of the Trace Classes
+// =======================================================================
+
+inline void TraceRing::Collect(std::vector<TraceRecord> &out) const {
+  const auto head = head_.load(std::memory_order_acquire);
+  const auto first = head > kCapacity ? head - kCapacity : 0;
+  for (auto i = first; i < head; ++i) {
+    const auto &slot = slots_[i & (kCapacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != i + 1) {
+      continue;
+    }
+    std::array<std::uint64_t, kWords> words{};
+    for (std::size_t w = 0; w < kWords; ++w) {
+      words[w] = slot.words[w].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != i + 1) {
+      continue;
+    }
+    TraceRecord record{};
+    std::memcpy(&record, words.data(), sizeof(record));
+    out.push_back(record);
+  }
+}
+
+inline auto TraceRegistry::Register(std::string_view name) -> std::uint16_t {
+  std::lock_guard lock{mutex_};
+  names_.emplace_back(name);
+  return static_cast<std::uint16_t>(names_.size() - 1);
+}
+
+inline auto TraceRegistry::AddRing() -> TraceRing & {
+  std::lock_guard lock{mutex_};
+  rings_.push_back(
+      std::make_unique<TraceRing>(static_cast<std::uint32_t>(rings_.size())));
+  return *rings_.back();
+}
+
+inline auto TraceRegistry::Collect() -> std::vector<TraceRecord> {
+  std::lock_guard lock{mutex_};
+  std::vector<TraceRecord> records;
+  for (const auto &ring : rings_) {
+    ring->Collect(records);
+  }
+  return records;
+}
+
+inline auto TraceRegistry::Names() -> std::vector<std::string> {
+  std::lock_guard lock{mutex_};
+  return names_;
+}
+
+namespace detail {
+
+constexpr std::array<char, 4> kTraceMagic{'V', 'S', 'M', 'T'};
+constexpr std::uint32_t kTraceVersion = 1;
+
+template <typename T>
+void WritePod(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+auto ReadPod(std::istream &in, T &value) -> bool {
+  return static_cast<bool>(
+      in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+/// @brief The bytes left in `in`, or the largest value if it cannot seek.
+inline auto Remaining(std::istream &in) -> std::uint64_t {
+  const auto here = in.tellg();
+  if (here == std::istream::pos_type(-1) || !in.seekg(0, std::ios::end)) {
+    in.clear();
+    return std::numeric_limits<std::uint64_t>::max();
+  }
+  const auto end = in.tellg();
+  in.seekg(here);
+  return static_cast<std::uint64_t>(end - here);
+}
+
+}  // namespace detail
+
+inline void WriteTrace(std::ostream &out, const Trace &trace) {
+  detail::WritePod(out, detail::kTraceMagic);
+  detail::WritePod(out, detail::kTraceVersion);
+  detail::WritePod(out, trace.ticks_per_us);
+  detail::WritePod(out, static_cast<std::uint32_t>(trace.names.size()));
+  for (const auto &name : trace.names) {
+    detail::WritePod(out, static_cast<std::uint32_t>(name.size()));
+    out.write(name.data(), static_cast<std::streamsize>(name.size()));
+  }
+  detail::WritePod(out, static_cast<std::uint64_t>(trace.records.size()));
+  out.write(reinterpret_cast<const char *>(trace.records.data()),
+            static_cast<std::streamsize>(trace.records.size() *
+                                         sizeof(TraceRecord)));
+}
+
+inline auto ReadTrace(std::istream &in, Trace &trace) -> bool {
+  std::array<char, 4> magic{};
+  std::uint32_t version = 0;
+  std::uint32_t names = 0;
+  if (!detail::ReadPod(in, magic) || magic != detail::kTraceMagic ||
+      !detail::ReadPod(in, version) || version != detail::kTraceVersion ||
+      !detail::ReadPod(in, trace.ticks_per_us) ||
+      !detail::ReadPod(in, names)) {
+    return false;
+  }
+  trace.names.clear();
+  for (std::uint32_t i = 0; i < names; ++i) {
+    std::uint32_t size = 0;
+    if (!detail::ReadPod(in, size) || size > detail::Remaining(in)) {
+      return false;
+    }
+    std::string name(size, '\0');
+    if (!in.read(name.data(), size)) {
+      return false;
+    }
+    trace.names.push_back(std::move(name));
+  }
+  std::uint64_t records = 0;
+  if (!detail::ReadPod(in, records) ||
+      records > detail::Remaining(in) / sizeof(TraceRecord)) {
+    return false;
+  }
+  // Grows with what was read, a stream that cannot seek may still be short.
+  constexpr std::uint64_t kChunk = 4096;
+  trace.records.clear();
+  while (trace.records.size() < records) {
+    const auto read = trace.records.size();
+    const auto count = std::min(kChunk, records - read);
+    trace.records.resize(read + count);
+    if (!in.read(reinterpret_cast<char *>(trace.records.data() + read),
+                 static_cast<std::streamsize>(count * sizeof(TraceRecord)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace vsm
+
+#endif
@@ -0,0 +1,250 @@
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_VARIANT_MACHINE_H_
+#define VARIADICSTATEMACHINE_VARIANT_MACHINE_H_
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "vsm/vsm.hpp"
+
+namespace vsm {
+
+/// @brief A state machine that only keeps the active state alive. The states
+/// share the storage of a std::variant, so the machine is as large as its
+/// largest state rather than the sum of all of them.
+///
+/// A transition exits and destroys the active state, then constructs the
+/// target from the triggering event if it has a constructor taking it, and
+/// default constructs it otherwise. State data therefore does not survive
+/// leaving a state, use BasicStateMachine for states that must keep it.
+/// If constructing the target throws, the exception propagates. The machine
+/// then either still holds the exited state or, if the variant had to give
+/// it up, no state at all and ignores every later event.
+/// Composite states are not supported.
+template <typename Observer, typename InitialState, typename... States>
+class BasicVariantStateMachine : private Observer {
+ public:
+  /// @brief Constructs a new state machine.
+  /// @param observer       The observer receiving the hooks.
+  /// @param initial_state  The initial state the state machine begins in,
+  /// the remaining states are only constructed when transitioned to.
+  BasicVariantStateMachine(Observer observer, InitialState initial_state)
+      : Observer{std::move(observer)},
+        state_{std::in_place_type<InitialState>, std::move(initial_state)} {}
+
+  /// @brief Calls the initial transition of the initial state.
+  void InitialTransition() {
+    GetObserver().template OnInitialTransition<InitialState>();
+    auto &state = std::get<InitialState>(state_);
+    if constexpr (detail::HasOnEnter<InitialState &>::value) {
+      state.OnEnter();
+    }
+  }
+
+  /// @brief Processes the current state, calling its Process(...) function.
+  /// Note: Might result in a transition.
+  void Process();
+
+  /// @brief Forwards the event to the currently active state, states without
+  /// a matching Handle(...) ignore it.
+  /// An rvalue `event` is forwarded to Handle(...) of the state and on to
+  /// OnEnter(...) of a transition's target.
+  /// Note: Might result in a transition.
+  template <typename Event>
+  void Handle(Event &&event);
+
+  /// @brief Checks if the active state has a Handle(...) for `Event`.
+  template <typename Event>
+  [[nodiscard]] auto CanHandle() const -> bool {
+    constexpr std::array<bool, kStates> kHandles{
+        detail::HasHandle<InitialState, Event>::value,
+        detail::HasHandle<States, Event>::value...};
+    return !state_.valueless_by_exception() && kHandles[state_.index()];
+  }
+
+  /// @brief Checks if the state machine is currently in a specific state.
+  template <typename State>
+  [[nodiscard]] auto IsInState() const -> bool {
+    static_assert(kContains<State>, "State not part of state machine");
+    return state_.index() == kIndexOf<State>;
+  }
+
+  /// @brief Returns a specific state from the state machine, throws
+  /// std::bad_variant_access unless it is the active state.
+  template <typename State>
+  [[nodiscard]] auto GetState() -> State & {
+    return std::get<State>(state_);
+  }
+
+  /// @brief Returns the observer of this state machine
+  [[nodiscard]] auto GetObserver() -> Observer & { return *this; }
+
+ private:
+  template <typename, typename>
+  friend struct TransitionTo;
+
+  static constexpr std::size_t kStates = 1 + sizeof...(States);
+
+  template <typename State>
+  static constexpr bool kContains =
+      (std::is_same_v<State, InitialState> ||
+       (std::is_same_v<State, States> || ...));
+
+  template <typename State>
+  static constexpr auto kIndexOf =
+      detail::index_of_v<State, InitialState, States...>;
+
+  /// @brief Destroys the active `From` and constructs `To` in its place,
+  /// from `args` if possible. An event is passed as const and stays
+  /// available to OnEnter(...), a payload is either taken by
+  /// OnEnter(Payload&&) or used for construction.
+  template <typename From, typename To, typename ExitFn, typename EnterFn,
+            typename... Args>
+  void Transition(ExitFn &&exit, EnterFn &&enter, Args &&...args);
+
+  /// @brief Calls `visitor` with the active state, through a compile-time
+  /// table indexed by the index of the variant.
+  template <typename Visitor>
+  void Dispatch(Visitor &visitor);
+
+  template <std::size_t I, typename Visitor>
+  static void DispatchTo(BasicVariantStateMachine &machine, Visitor &visitor) {
+    visitor(*std::get_if<I>(&machine.state_));
+  }
+
+  template <typename Visitor, std::size_t... I>
+  static constexpr auto MakeDispatchTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = void (*)(BasicVariantStateMachine &, Visitor &);
+    return std::array<Fn, sizeof...(I)>{&DispatchTo<I, Visitor>...};
+  }
+
+  /// @brief The active state, the only one alive
+  std::variant<InitialState, States...> state_;
+};
+
+/// @brief Variant storage counterpart of StateMachine, reports transitions
+/// between named states to an optional log callback.
+template <typename InitialState, typename... States>
+class VariantStateMachine
+    : public BasicVariantStateMachine<LogCallbackObserver, InitialState,
+                                      States...> {
+ public:
+  using LogCallback = LogCallbackObserver::LogCallback;
+
+  /// @brief Constructs a new state machine.
+  /// @param initial_state  The initial state the state machine begins in.
+  explicit VariantStateMachine(InitialState initial_state)
+      : BasicVariantStateMachine<LogCallbackObserver, InitialState,
+                                 States...>{LogCallbackObserver{},
+                                            std::move(initial_state)} {}
+
+  /// @brief Sets an optional log callback that is called for every transition
+  /// @param log_cb The callback to use, syntax should take (from, to)
+  void SetLogCallback(LogCallback log_cb) {
+    this->GetObserver().SetLogCallback(std::move(log_cb));
+  }
+};
+
+namespace detail {
+
+template <typename Observer, typename InitialState, typename... States>
+struct ConstructsStates<
+    BasicVariantStateMachine<Observer, InitialState, States...>>
+    : std::true_type {};
+
+}  // namespace detail
+
+// =======================================================================
+// Implementation of BasicVariantStateMachine Class
+// =======================================================================
+
+template <typename Observer, typename InitialState, typename... States>
+void BasicVariantStateMachine<Observer, InitialState, States...>::Process() {
+  auto state_visitor = [this](auto &state) {
+    if constexpr (detail::HasProcess<
+                      std::remove_reference_t<decltype(state)>>::value) {
+      state.Process().Execute(*this, state);
+    }
+  };
+  Dispatch(state_visitor);
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename Event>
+void BasicVariantStateMachine<Observer, InitialState, States...>::Handle(
+    Event &&event) {
+  auto state_visitor = [this, &event](auto &state) {
+    using State = std::remove_reference_t<decltype(state)>;
+    if constexpr (detail::HasHandle<State, Event>::value) {
+      GetObserver().template OnEventDispatched<State>(event);
+      detail::EventHandledGuard<State, std::decay_t<Event>, Observer> handled{
+          GetObserver()};
+      detail::HandleAndExecute(*this, state, std::forward<Event>(event));
+    } else {
+      GetObserver().template OnUnhandled<State>(event);
+    }
+  };
+  Dispatch(state_visitor);
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename From, typename To, typename ExitFn, typename EnterFn,
+          typename... Args>
+void BasicVariantStateMachine<Observer, InitialState, States...>::Transition(
+    ExitFn &&exit, EnterFn &&enter, Args &&...args) {
+  static_assert(kContains<To>,
+                "Invalid state transition: State not part of state machine");
+  // A payload, passed as rvalue, goes to OnEnter(Payload&&) if it takes it.
+  constexpr bool kEnterTakesPayload =
+      sizeof...(Args) == 1 && (std::is_rvalue_reference_v<Args &&> && ...) &&
+      detail::HasOnEnter<To, Args &&...>::value;
+  exit(std::get<From>(state_));
+  if constexpr (std::is_constructible_v<To, Args &&...> &&
+                !kEnterTakesPayload) {
+    state_.template emplace<To>(std::forward<Args>(args)...);
+  } else {
+    static_assert(std::is_default_constructible_v<To>,
+                  "State must be constructible from the event or by default");
+    state_.template emplace<To>();
+  }
+  enter(std::get<To>(state_));
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename Visitor>
+void BasicVariantStateMachine<Observer, InitialState, States...>::Dispatch(
+    Visitor &visitor) {
+  static constexpr auto kTable =
+      MakeDispatchTable<Visitor>(std::make_index_sequence<kStates>{});
+  if (state_.valueless_by_exception()) {
+    return;
+  }
+  kTable[state_.index()](*this, visitor);
+}
+
+}  // namespace vsm
+
+#endif
@@ -1,306 +1,1517 @@
-// Copyright (c) 2024 Julian Gottwald
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy
-// of this software and associated documentation files (the "Software"), to
-// deal in the Software without restriction, including without limitation the
-// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
-// sell copies of the Software, and to permit persons to whom the Software is
-// furnished to do so, subject to the following conditions:
-//
-// The above copyright notice and this permission notice shall be included in
-// all copies or substantial portions of the Software.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
-// DEALINGS IN THE SOFTWARE.
-
-#ifndef VARIADICSTATEMACHINE_VSM_H_
-#define VARIADICSTATEMACHINE_VSM_H_
-
-#include <functional>
-#include <string_view>
-#include <tuple>
-#include <variant>
-
-namespace vsm {
-
-namespace detail {
-template <typename T, typename = void>
-// NOLINTNEXTLINE(readability-identifier-naming)
-constexpr bool is_complete_v = false;
-
-template <typename T>
-// NOLINTNEXTLINE(readability-identifier-naming)
-constexpr bool is_complete_v<T, decltype(void(sizeof(T)))> = true;
-
-template <typename T, typename = void>
-struct HasName : std::false_type {};
-
-template <typename T>
-struct HasName<
-    T, std::enable_if_t<is_complete_v<T>, std::void_t<decltype(T::Name())>>>
-    : std::true_type {};
-
-template <typename, typename = std::void_t<>>
-struct HasProcess : std::false_type {};
-
-template <typename T>
-struct HasProcess<
-    T, std::enable_if_t<is_complete_v<T>,
-                        std::void_t<decltype(std::declval<T>().Process())>>>
-    : std::true_type {};
-
-}  // namespace detail
-
-template <typename ToState>
-struct TransitionTo;
-
-/// @brief Implements a state machine that can transition between states.
-/// It can handle events, perform entry, process, and exit actions.
-template <typename InitialState, typename... States>
-class StateMachine {
- public:
-  using LogCallback = std::function<void(std::string_view, std::string_view)>;
-
-  /// @brief Constructs a new state machine.
-  /// @param initial_state  The initial state the state machine begins in.
-  /// @param states         The remaining states the state machine can
-  /// transition to.
-  explicit StateMachine(InitialState initial_state, States... states);
-
-  /// @brief Calls the initial transition of the initial state.
-  void InitialTransition() { std::get<InitialState>(states_).OnEnter(); }
-
-  /// @brief Processes the current state, calling its Process(...) function.
-  /// Note: Might result in a transition.
-  void Process();
-
-  /// @brief Forwards the event to the currently active state.
-  /// Note: Might result in a transition.
-  template <typename Event>
-  void Handle(const Event &event);
-
-  /// @brief Checks if the state machine is currently in a specific state.
-  template <typename State>
-  [[nodiscard]] auto IsInState() const -> bool {
-    return std::holds_alternative<State *>(current_state_);
-  }
-
-  /// @brief Sets an optional log callback that is called for every transition
-  /// @param log_cb The callback to use, syntax should take (from, to)
-  void SetLogCallback(LogCallback log_cb);
-
-  /// @brief Returns a specific state from the state machine
-  /// @tparam State The state to return
-  /// @return A reference to the state
-  template <typename State>
-  [[nodiscard]] auto GetState() -> State & {
-    return std::get<State>(states_);
-  }
-
- private:
-  template <typename ToState>
-  friend struct TransitionTo;
-
-  /// @brief Causes the statemachine to transition to a new state
-  /// @tparam State     The state to transition to
-  /// @return A reference to the internal state
-  template <typename State>
-  auto TransitionTo() -> State &;
-
-  /// @brief The list of states the statemachine holds, no duplicates possible
-  std::tuple<InitialState, States...> states_;
-
-  /// @brief Holds a pointer to the currently active state
-  std::variant<InitialState *, States *...> current_state_;
-
-  /// @brief The logging callback
-  LogCallback log_cb_;
-};
-
-/// @brief Defines a transition to a state, moves the statemachine to the state
-/// if executed.
-/// @tparam ToState     The state the transition targets
-template <typename ToState>
-struct TransitionTo {
-  /// @brief Executes this transition
-  template <typename StateMachine, typename FromState, typename... Event>
-  void Execute(StateMachine &machine, FromState &from, const Event &...event);
-
- private:
-  template <typename... Parameters>
-  void Exit(Parameters... /* p */) {}
-  template <typename State, typename... Events>
-  auto Exit(State &from, Events... /* events */) -> decltype(from.OnExit());
-  template <typename State, typename Event>
-  auto Exit(State &from, const Event &event) -> decltype(from.OnExit(event));
-
-  template <typename... Parameters>
-  void Enter(Parameters... /* p */) {}
-  template <typename State, typename... Events>
-  auto Enter(State &to_state, Events... /* events */)
-      -> decltype(to_state.OnEnter());
-  template <typename State, typename Event>
-  auto Enter(State &to_state, const Event &event)
-      -> decltype(to_state.OnEnter(event));
-
-  template <typename StateMachine, typename FromState>
-  void Log(StateMachine &machine);
-};
-
-/// @brief Convenience transition that does nothing.
-struct DoNothing {
-  template <typename... Parameters>
-  void Execute(Parameters... /* p */) const {}
-};
-
-/// @brief Convenience transition that can contain different transitions for
-/// branching
-/// @tparam ...Transitions  The transitions that can be contained
-template <typename... Transitions>
-struct Either {
-  template <typename Transition>
-  // NOLINTNEXTLINE(google-explicit-constructor)
-  Either(Transition transition) : transition_{std::move(transition)} {}
-
-  template <typename StateMachine, typename FromState, typename... Event>
-  void Execute(StateMachine &machine, FromState &from, const Event &...event);
-
- private:
-  std::variant<Transitions...> transition_;
-};
-
-/// @brief Convenience transition that can contain different transitions or
-/// nothing.
-/// @tparam ...Transitions  The transitions that can be contained
-template <typename... Transitions>
-struct Maybe : public Either<Transitions..., DoNothing> {
-  using Either<Transitions..., DoNothing>::Either;
-};
-
-// =======================================================================
-// Implementation of StateMachine Class
-// =======================================================================
-
-template <typename InitialState, typename... States>
-StateMachine<InitialState, States...>::StateMachine(InitialState initial_state,
-                                                    States... states)
-    : states_{std::forward<InitialState>(initial_state),
-              std::forward<States>(states)...},
-      current_state_{&std::get<0>(states_)} {}
-
-template <typename InitialState, typename... States>
-void StateMachine<InitialState, States...>::Process() {
-  auto state_visitor = [this](auto *state) {
-    if constexpr (detail::HasProcess<
-                      std::remove_pointer_t<decltype(state)>>::value) {
-      state->Process().Execute(*this, *state);
-    }
-  };
-  std::visit(state_visitor, current_state_);
-}
-
-template <typename InitialState, typename... States>
-template <typename Event>
-void StateMachine<InitialState, States...>::Handle(const Event &event) {
-  auto state_vistor = [this, &event](auto *state) -> void {
-    state->Handle(event).Execute(*this, *state, event);
-  };
-  std::visit(state_vistor, current_state_);
-}
-
-template <typename InitialState, typename... States>
-void StateMachine<InitialState, States...>::SetLogCallback(LogCallback log_cb) {
-  log_cb_ = std::move(log_cb);
-}
-
-template <typename InitialState, typename... States>
-template <typename State>
-auto StateMachine<InitialState, States...>::TransitionTo() -> State & {
-  static_assert((std::is_same_v<State, InitialState> ||
-                 (std::is_same_v<State, States> || ...)),
-                "Invalid state transition: State not part of state machine");
-  auto &state = std::get<State>(states_);
-  current_state_ = &state;
-  return state;
-}
-
-// =======================================================================
-// Implementation of TransitionTo Class
-// =======================================================================
-template <typename ToState>
-template <typename StateMachine, typename FromState, typename... Event>
-void TransitionTo<ToState>::Execute(StateMachine &machine, FromState &from,
-                                    const Event &...event) {
-  Log<StateMachine, FromState>(machine);
-  Exit(from, event...);
-  auto &to_state = machine.template TransitionTo<ToState>();
-  Enter(to_state, event...);
-}
-
-template <typename ToState>
-template <typename State, typename... Events>
-auto TransitionTo<ToState>::Exit(State &from, Events... /* events */)
-    -> decltype(from.OnExit()) {
-  from.OnExit();
-}
-
-template <typename ToState>
-template <typename State, typename Event>
-auto TransitionTo<ToState>::Exit(State &from, const Event &event)
-    -> decltype(from.OnExit(event)) {
-  from.OnExit(event);
-}
-
-template <typename ToState>
-template <typename State, typename... Events>
-auto TransitionTo<ToState>::Enter(State &to_state, Events... /* events */)
-    -> decltype(to_state.OnEnter()) {
-  to_state.OnEnter();
-}
-
-template <typename ToState>
-template <typename State, typename Event>
-auto TransitionTo<ToState>::Enter(State &to_state, const Event &event)
-    -> decltype(to_state.OnEnter(event)) {
-  to_state.OnEnter(event);
-}
-
-template <typename ToState>
-template <typename StateMachine, typename FromState>
-void TransitionTo<ToState>::Log(StateMachine &machine) {
-  if constexpr (detail::HasName<FromState>::value &&
-                detail::HasName<ToState>::value) {
-    if (machine.log_cb_) {
-      machine.log_cb_(FromState::Name(), ToState::Name());
-    }
-  } else {
-    static_assert(detail::is_complete_v<FromState>,
-                  "FromState must be fully defined.");
-    static_assert(detail::is_complete_v<ToState>,
-                  "ToState must be fully defined.");
-  }
-}
-
-// =======================================================================
-// Implementation of Either Class
-// =======================================================================
-
-template <typename... Transitions>
-template <typename StateMachine, typename FromState, typename... Event>
-void Either<Transitions...>::Execute(StateMachine &machine, FromState &from,
-                                     const Event &...event) {
-  auto transition_visitor = [&machine, &from,
-                             &event...](auto &transition) -> void {
-    transition.Execute(machine, from, event...);
-  };
-  std::visit(transition_visitor, transition_);
-}
-
-}  // namespace vsm
-
-#endif
+// Copyright (c) 2024 Julian Gottwald
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef VARIADICSTATEMACHINE_VSM_H_
+#define VARIADICSTATEMACHINE_VSM_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "vsm/probes.hpp"
+
+namespace vsm {
+
+namespace detail {
+template <typename T, typename = void>
+// NOLINTNEXTLINE(readability-identifier-naming)
+constexpr bool is_complete_v = false;
+
+template <typename T>
+// NOLINTNEXTLINE(readability-identifier-naming)
+constexpr bool is_complete_v<T, decltype(void(sizeof(T)))> = true;
+
+template <typename T, typename = void>
+struct HasName : std::false_type {};
+
+template <typename T>
+struct HasName<
+    T, std::enable_if_t<is_complete_v<T>, std::void_t<decltype(T::Name())>>>
+    : std::true_type {};
+
+template <typename, typename = std::void_t<>>
+struct HasProcess : std::false_type {};
+
+template <typename T>
+struct HasProcess<
+    T, std::enable_if_t<is_complete_v<T>,
+                        std::void_t<decltype(std::declval<T>().Process())>>>
+    : std::true_type {};
+
+template <typename, typename T, typename... Args>
+struct HasOnEnterImpl : std::false_type {};
+
+template <typename T, typename... Args>
+struct HasOnEnterImpl<
+    std::void_t<decltype(std::declval<T &>().OnEnter(std::declval<Args>()...))>,
+    T, Args...> : std::true_type {};
+
+/// @brief Whether `T` has an OnEnter(...) callable with `Args...`.
+template <typename T, typename... Args>
+using HasOnEnter = HasOnEnterImpl<void, T, Args...>;
+
+template <typename, typename T, typename... Args>
+struct HasOnExitImpl : std::false_type {};
+
+template <typename T, typename... Args>
+struct HasOnExitImpl<
+    std::void_t<decltype(std::declval<T &>().OnExit(std::declval<Args>()...))>,
+    T, Args...> : std::true_type {};
+
+/// @brief Whether `T` has an OnExit(...) callable with `Args...`.
+template <typename T, typename... Args>
+using HasOnExit = HasOnExitImpl<void, T, Args...>;
+
+/// @brief Whether `T` arms timeouts delivered to a `Machine`, see Timeouts
+/// in vsm/timer.hpp.
+template <typename T, typename Machine, typename = std::void_t<>>
+struct HasTimeouts : std::false_type {};
+
+template <typename T, typename Machine>
+struct HasTimeouts<T, Machine,
+                   std::void_t<decltype(std::declval<T &>().BindTimeouts(
+                       std::declval<Machine &>()))>> : std::true_type {};
+
+/// @brief Whether `T` has a Handle(...) accepting an `Event`, which is
+/// passed as an rvalue unless `Event` is a reference type.
+template <typename, typename, typename = std::void_t<>>
+struct HasHandle : std::false_type {};
+
+template <typename T, typename Event>
+struct HasHandle<
+    T, Event,
+    std::enable_if_t<is_complete_v<T>,
+                     std::void_t<decltype(std::declval<T>().Handle(
+                         std::declval<Event>()))>>> : std::true_type {};
+
+/// @brief The smallest unsigned integer able to index `N` states.
+template <std::size_t N>
+using StateIndex = std::conditional_t<
+    (N <= std::numeric_limits<std::uint8_t>::max() + std::size_t{1}),
+    std::uint8_t,
+    std::conditional_t<
+        (N <= std::numeric_limits<std::uint16_t>::max() + std::size_t{1}),
+        std::uint16_t, std::uint32_t>>;
+
+/// @brief Position of `T` in `Ts...`, `sizeof...(Ts)` if not contained.
+template <typename T, typename... Ts>
+struct IndexOf : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename Head, typename... Tail>
+struct IndexOf<T, Head, Tail...>
+    : std::integral_constant<std::size_t,
+                             std::is_same_v<T, Head>
+                                 ? 0
+                                 : 1 + IndexOf<T, Tail...>::value> {};
+
+template <typename T, typename... Ts>
+// NOLINTNEXTLINE(readability-identifier-naming)
+constexpr std::size_t index_of_v = IndexOf<T, Ts...>::value;
+
+template <typename... Ts>
+struct TypeList {};
+
+/// @brief A unique address per type, identifies types without RTTI.
+template <typename T>
+struct TypeTag {
+  static constexpr char kTag = 0;
+};
+
+template <std::size_t I, typename List>
+struct TypeAt;
+
+template <std::size_t I, typename... Ts>
+struct TypeAt<I, TypeList<Ts...>> {
+  using type = std::tuple_element_t<I, std::tuple<Ts...>>;
+};
+
+template <std::size_t I, typename List>
+using type_at_t = typename TypeAt<I, List>::type;
+
+template <typename List>
+struct Size;
+
+template <typename... Ts>
+struct Size<TypeList<Ts...>>
+    : std::integral_constant<std::size_t, sizeof...(Ts)> {};
+
+template <typename... Lists>
+struct Concat {
+  using type = TypeList<>;
+};
+
+template <typename... Ts>
+struct Concat<TypeList<Ts...>> {
+  using type = TypeList<Ts...>;
+};
+
+template <typename... Ts, typename... Us, typename... Rest>
+struct Concat<TypeList<Ts...>, TypeList<Us...>, Rest...>
+    : Concat<TypeList<Ts..., Us...>, Rest...> {};
+
+/// @brief Number of leading types `A` and `B` have in common.
+template <typename A, typename B>
+struct CommonPrefix : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename... Ts, typename... Us>
+struct CommonPrefix<TypeList<T, Ts...>, TypeList<T, Us...>>
+    : std::integral_constant<
+          std::size_t,
+          1 + CommonPrefix<TypeList<Ts...>, TypeList<Us...>>::value> {};
+
+}  // namespace detail
+
+template <typename ToState, typename Payload = void>
+struct TransitionTo;
+
+template <typename Observer, typename InitialState, typename... States>
+class BasicStateMachine;
+
+/// @brief A state that is a sub-machine of other states. It behaves like
+/// `Parent`, whose Handle(...) receives all events the active child does not
+/// handle. Entering it enters `InitialChild`, transitions can target the
+/// composite by its `Parent` type or any of its (nested) children.
+/// @tparam Parent        The state holding the shared data and handlers
+/// @tparam InitialChild  The child that becomes active on entry
+/// @tparam ...Children   The remaining children, states or composites
+template <typename Parent, typename InitialChild, typename... Children>
+class Composite : public Parent {
+ public:
+  using ParentState = Parent;
+
+  Composite(Parent parent, InitialChild initial_child, Children... children)
+      : Parent{std::move(parent)},
+        children_{std::move(initial_child), std::move(children)...} {}
+
+ private:
+  template <typename, typename, typename...>
+  friend class BasicStateMachine;
+
+  std::tuple<InitialChild, Children...> children_;
+};
+
+namespace detail {
+
+/// @brief The paths from `Node` to each of its leaf states, every path lists
+/// the composites above the leaf followed by the leaf itself.
+template <typename Node, typename... Ancestors>
+struct LeafPaths {
+  using type = TypeList<TypeList<Ancestors..., Node>>;
+};
+
+template <typename Parent, typename... Children, typename... Ancestors>
+struct LeafPaths<Composite<Parent, Children...>, Ancestors...>
+    : Concat<typename LeafPaths<Children, Ancestors...,
+                                Composite<Parent, Children...>>::type...> {};
+
+/// @brief Whether the state `Node` is `T`, composites also match their parent.
+template <typename Node, typename T>
+struct Matches : std::is_same<Node, T> {};
+
+template <typename Parent, typename... Children, typename T>
+struct Matches<Composite<Parent, Children...>, T>
+    : std::bool_constant<std::is_same_v<Composite<Parent, Children...>, T> ||
+                         std::is_same_v<Parent, T>> {};
+
+/// @brief Position of `T` within the path, the path's size if not on it.
+template <typename T, typename... Nodes>
+constexpr auto DepthOf(TypeList<Nodes...> /* path */) -> std::size_t {
+  constexpr std::array<bool, sizeof...(Nodes)> kMatches{
+      Matches<Nodes, T>::value...};
+  for (std::size_t i = 0; i < kMatches.size(); ++i) {
+    if (kMatches[i]) {
+      return i;
+    }
+  }
+  return sizeof...(Nodes);
+}
+
+/// @brief The leaves [first, second) of all `paths` that pass through `T`.
+template <typename T, typename... Paths>
+constexpr auto LeafRange(TypeList<Paths...> /* paths */)
+    -> std::pair<std::size_t, std::size_t> {
+  constexpr std::array<bool, sizeof...(Paths)> kContains{
+      (DepthOf<T>(Paths{}) < Size<Paths>::value)...};
+  std::size_t first = 0;
+  while (first < kContains.size() && !kContains[first]) {
+    ++first;
+  }
+  auto last = first;
+  while (last < kContains.size() && kContains[last]) {
+    ++last;
+  }
+  return {first, last};
+}
+
+/// @brief Position of the deepest state on the path satisfying `Trait`, the
+/// path's size if there is none.
+template <template <typename> class Trait, typename... Nodes>
+constexpr auto DeepestWith(TypeList<Nodes...> /* path */) -> std::size_t {
+  constexpr std::array<bool, sizeof...(Nodes)> kHas{Trait<Nodes>::value...};
+  for (auto i = kHas.size(); i-- > 0;) {
+    if (kHas[i]) {
+      return i;
+    }
+  }
+  return sizeof...(Nodes);
+}
+
+/// @brief Calls OnExit(event) if available, OnExit() otherwise.
+template <typename State, typename... Event>
+void ExitState(State &from, const Event &...event) {
+  if constexpr (HasOnExit<State, const Event &...>::value) {
+    from.OnExit(event...);
+  } else if constexpr (HasOnExit<State>::value) {
+    from.OnExit();
+  }
+}
+
+/// @brief Calls OnEnter(event) if available, OnEnter() otherwise.
+template <typename State, typename... Event>
+void EnterState(State &to_state, Event &&...event) {
+  if constexpr (HasOnEnter<State, Event &&...>::value) {
+    to_state.OnEnter(std::forward<Event>(event)...);
+  } else if constexpr (HasOnEnter<State>::value) {
+    to_state.OnEnter();
+  }
+}
+
+/// @brief Calls Handle(...) of `state` and executes the returned transition,
+/// the event is forwarded only once. A Handle(...) accepting an lvalue gets
+/// one, taken by value it is a copy, and the transition may move the event
+/// into its target. A Handle(...) accepting only an rvalue owns the event,
+/// the transition then sees it as const.
+template <typename Machine, typename State, typename Event>
+void HandleAndExecute(Machine &machine, State &state, Event &&event) {
+  if constexpr (HasHandle<State, Event &>::value) {
+    state.Handle(event).Execute(machine, state, std::forward<Event>(event));
+  } else {
+    state.Handle(std::forward<Event>(event))
+        .Execute(machine, state, std::as_const(event));
+  }
+}
+
+/// @brief Calls OnEventHandled<State, Event>() of the observer when leaving
+/// the scope, also if handling the event threw.
+template <typename State, typename Event, typename Observer>
+class EventHandledGuard {
+ public:
+  explicit EventHandledGuard(Observer &observer) : observer_{observer} {}
+  EventHandledGuard(const EventHandledGuard &) = delete;
+  auto operator=(const EventHandledGuard &) = delete;
+  // May throw like the observer, unless already unwinding.
+  ~EventHandledGuard() noexcept(false) {
+    observer_.template OnEventHandled<State, Event>();
+  }
+
+ private:
+  Observer &observer_;
+};
+
+/// @brief Whether `Machine` constructs the target of a transition from the
+/// transition's data, see BasicVariantStateMachine.
+template <typename Machine>
+struct ConstructsStates : std::false_type {};
+
+/// @brief Bit `i` is set if a state on the `i`-th path satisfies `Trait`.
+template <template <typename> class Trait, typename... Paths>
+constexpr auto LeafMask(TypeList<Paths...> /* paths */)
+    -> std::array<std::uint64_t, (sizeof...(Paths) + 63) / 64> {
+  constexpr std::array<bool, sizeof...(Paths)> kHas{
+      (DeepestWith<Trait>(Paths{}) < Size<Paths>::value)...};
+  std::array<std::uint64_t, (sizeof...(Paths) + 63) / 64> mask{};
+  for (std::size_t i = 0; i < kHas.size(); ++i) {
+    if (kHas[i]) {
+      mask[i / 64] |= std::uint64_t{1} << (i % 64);
+    }
+  }
+  return mask;
+}
+
+template <std::size_t N>
+constexpr auto CountBits(const std::array<std::uint64_t, N> &mask)
+    -> std::size_t {
+  std::size_t count = 0;
+  for (auto word : mask) {
+    for (; word != 0; word &= word - 1) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+}  // namespace detail
+
+/// @brief Observer that does nothing, all hooks compile away. Derive from it
+/// to implement only some of the hooks.
+struct NoObserver {
+  /// @brief Called by InitialTransition(), before entering the initial
+  /// `State`.
+  template <typename State>
+  void OnInitialTransition() {}
+
+  /// @brief Called for every executed transition, before exiting `From`.
+  template <typename From, typename To, typename... Event>
+  void OnTransition(const Event &.../* event */) {}
+
+  /// @brief Called before `event` is handed to the active `State`.
+  template <typename State, typename Event>
+  void OnEventDispatched(const Event & /* event */) {}
+
+  /// @brief Called after the active `State` handled an `Event`, including
+  /// the transition it returned, or after either threw. The event may have
+  /// been moved from.
+  template <typename State, typename Event>
+  void OnEventHandled() {}
+
+  /// @brief Called if the active `State` has no Handle(...) for `event`.
+  template <typename State, typename Event>
+  void OnUnhandled(const Event & /* event */) {}
+};
+
+/// @brief Observer that forwards transitions between named states to a
+/// callback, see StateMachine::SetLogCallback.
+class LogCallbackObserver : public NoObserver {
+ public:
+  using LogCallback = std::function<void(std::string_view, std::string_view)>;
+
+  /// @brief Sets the callback, syntax should take (from, to)
+  void SetLogCallback(LogCallback log_cb) { log_cb_ = std::move(log_cb); }
+
+  template <typename From, typename To, typename... Event>
+  void OnTransition(const Event &.../* event */);
+
+ private:
+  LogCallback log_cb_;
+};
+
+/// @brief Appends the data of states to a snapshot, see
+/// BasicStateMachine::Snapshot(). States that are not trivially copyable opt
+/// in with `void Serialize(SnapshotWriter &) const`.
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(std::vector<std::byte> &buffer) : buffer_{buffer} {}
+
+  void Write(const void *data, std::size_t size) {
+    const auto offset = buffer_.size();
+    buffer_.resize(offset + size);
+    std::memcpy(buffer_.data() + offset, data, size);
+  }
+
+  template <typename T>
+  void Write(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only trivially copyable values can be written as is");
+    Write(&value, sizeof(T));
+  }
+
+ private:
+  std::vector<std::byte> &buffer_;
+};
+
+/// @brief Reads the data of states from a snapshot, see
+/// BasicStateMachine::Restore(). The counterpart of a Serialize(...) hook is
+/// `void Deserialize(SnapshotReader &)`.
+class SnapshotReader {
+ public:
+  SnapshotReader(const std::byte *data, std::size_t size)
+      : data_{data}, size_{size} {}
+
+  /// @return false if the snapshot is too short, nothing is read then
+  auto Read(void *data, std::size_t size) -> bool {
+    if (size > size_ - offset_) {
+      failed_ = true;
+      return false;
+    }
+    std::memcpy(data, data_ + offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+  template <typename T>
+  auto Read(T &value) -> bool {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only trivially copyable values can be read as is");
+    return Read(&value, sizeof(T));
+  }
+
+  /// @brief The number of bytes not read yet
+  [[nodiscard]] auto Remaining() const -> std::size_t {
+    return size_ - offset_;
+  }
+
+  /// @brief Whether every read so far succeeded
+  [[nodiscard]] auto Ok() const -> bool { return !failed_; }
+
+ private:
+  const std::byte *data_;
+  std::size_t size_;
+  std::size_t offset_ = 0;
+  bool failed_ = false;
+};
+
+namespace detail {
+
+template <typename T, typename = void>
+struct HasSerialize : std::false_type {};
+
+template <typename T>
+struct HasSerialize<
+    T, std::void_t<decltype(std::declval<const T &>().Serialize(
+                       std::declval<SnapshotWriter &>())),
+                   decltype(std::declval<T &>().Deserialize(
+                       std::declval<SnapshotReader &>()))>> : std::true_type {
+};
+
+/// @brief How a state is stored in a snapshot: 0 not at all, 1 as its bytes,
+/// 2 through its Serialize(...) hook. Empty states have nothing to store.
+template <typename T>
+constexpr std::uint64_t kSnapshotMode =
+    HasSerialize<T>::value
+        ? 2
+        : (std::is_trivially_copyable_v<T> &&
+                   std::is_trivially_copy_assignable_v<T> &&
+                   !std::is_empty_v<T>
+               ? 1
+               : 0);
+
+template <typename T>
+struct IsComposite : std::false_type {};
+
+template <typename Parent, typename... Children>
+struct IsComposite<Composite<Parent, Children...>> : std::true_type {};
+
+/// @brief The snapshot size of a state, none if it depends on a
+/// Serialize(...) hook.
+template <typename T>
+struct SnapshotSize {
+  static constexpr std::optional<std::size_t> value =
+      kSnapshotMode<T> == 2
+          ? std::nullopt
+          : std::optional{kSnapshotMode<T> == 1 ? sizeof(T) : 0};
+};
+
+template <typename Parent, typename... Children>
+struct SnapshotSize<Composite<Parent, Children...>>
+    : SnapshotSize<TypeList<Parent, Children...>> {};
+
+template <typename... Ts>
+struct SnapshotSize<TypeList<Ts...>> {
+  static constexpr std::optional<std::size_t> value =
+      (SnapshotSize<Ts>::value && ...)
+          ? std::optional{(std::size_t{0} + ... + *SnapshotSize<Ts>::value)}
+          : std::nullopt;
+};
+
+/// @brief Whether a snapshot holds all data of a state, false for a state
+/// with data that kSnapshotMode leaves out.
+template <typename T>
+struct SnapshotComplete
+    : std::bool_constant<kSnapshotMode<T> != 0 || std::is_empty_v<T>> {};
+
+template <typename Parent, typename... Children>
+struct SnapshotComplete<Composite<Parent, Children...>>
+    : std::conjunction<SnapshotComplete<Parent>,
+                       SnapshotComplete<Children>...> {};
+
+constexpr auto Fnv1a(std::string_view text, std::uint64_t hash)
+    -> std::uint64_t {
+  for (const char c : text) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/// @brief Hash of the state types, their sizes and how they are stored,
+/// computed at compile time from the signature of this function.
+template <typename... Ts>
+constexpr auto SnapshotLayoutHash() -> std::uint64_t {
+#if defined(_MSC_VER)
+  auto hash = Fnv1a(__FUNCSIG__, 0xcbf29ce484222325ULL);
+#else
+  auto hash = Fnv1a(__PRETTY_FUNCTION__, 0xcbf29ce484222325ULL);
+#endif
+  for (const auto value : {std::uint64_t{0}, (sizeof(Ts) * 4 +
+                                              kSnapshotMode<Ts>)...}) {
+    hash = (hash ^ value) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+constexpr std::array<char, 4> kSnapshotMagic{'V', 'S', 'M', 'S'};
+
+}  // namespace detail
+
+/// @brief Implements a state machine that can transition between states.
+/// It can handle events, perform entry, process, and exit actions. Every
+/// transition and dispatched event is reported to the statically typed
+/// `Observer`, see NoObserver for the hooks.
+template <typename Observer, typename InitialState, typename... States>
+class BasicStateMachine : private Observer {
+ public:
+  /// @brief Constructs a new state machine.
+  /// @param observer       The observer receiving the hooks.
+  /// @param initial_state  The initial state the state machine begins in.
+  /// @param states         The remaining states the state machine can
+  /// transition to.
+  BasicStateMachine(Observer observer, InitialState initial_state,
+                    States... states);
+
+  /// @brief Calls the initial transition of the initial state, composites
+  /// enter their initial children.
+  void InitialTransition();
+
+  /// @brief Processes the current state, calling its Process(...) function.
+  /// Note: Might result in a transition.
+  void Process();
+
+  /// @brief Forwards the event to the currently active state, states without
+  /// a matching Handle(...) ignore it. Unless the observer implements
+  /// OnUnhandled(...), such events return before any dispatch and events no
+  /// state handles compile to nothing.
+  /// An rvalue `event` is forwarded to Handle(...) of the state and on to
+  /// OnEnter(...) of a transition's target, neither copies nor moves it.
+  /// Note: Might result in a transition.
+  template <typename Event>
+  void Handle(Event &&event);
+
+  /// @brief Checks if the active state, or one of its composites, has a
+  /// Handle(...) for `Event`. A single bit test, constant if all or no states
+  /// handle it.
+  template <typename Event>
+  [[nodiscard]] auto CanHandle() const -> bool {
+    if constexpr (kHandlers<Event> == 0) {
+      return false;
+    } else if constexpr (kHandlers<Event> == kLeaves) {
+      return true;
+    } else {
+      return ((kHandlerMask<Event>[current_state_ / 64] >>
+               (current_state_ % 64)) &
+              1U) != 0;
+    }
+  }
+
+  /// @brief Forwards `n` events starting at `first` in order, equivalent to
+  /// calling Handle(...) for each. The active state is only looked up again
+  /// after one of them caused a transition.
+  template <typename Event>
+  void HandleBatch(const Event *first, std::size_t n);
+
+  /// @brief Forwards `n` events of different types starting at `first` in
+  /// order, see HandleBatch(const Event *, std::size_t).
+  template <typename... Events>
+  void HandleBatch(const std::variant<Events...> *first, std::size_t n);
+
+  /// @brief Checks if the state machine is currently in a specific state,
+  /// for a composite if any of its children is active.
+  template <typename State>
+  [[nodiscard]] auto IsInState() const -> bool {
+    static_assert(kContains<State>, "State not part of state machine");
+    if constexpr (kRange<State>.second - kRange<State>.first == 1) {
+      return current_state_ == kRange<State>.first;
+    } else {
+      return kRange<State>.first <= current_state_ &&
+             current_state_ < kRange<State>.second;
+    }
+  }
+
+  /// @brief Returns a specific state from the state machine
+  /// @tparam State The state to return, may be nested in a composite
+  /// @return A reference to the state
+  template <typename State>
+  [[nodiscard]] auto GetState() -> State & {
+    static_assert(kContains<State>, "State not part of state machine");
+    using StatePath = LeafPath<kRange<State>.first>;
+    return Node<detail::DepthOf<State>(StatePath{}), StatePath>();
+  }
+
+  /// @brief Returns the observer of this state machine
+  [[nodiscard]] auto GetObserver() -> Observer & { return *this; }
+
+  /// @brief Version of the format written by Snapshot()
+  static constexpr std::uint32_t kSnapshotVersion = 1;
+
+  /// @brief Hash of the state types the snapshot format depends on
+  static constexpr std::uint64_t kSnapshotHash =
+      detail::SnapshotLayoutHash<InitialState, States...>();
+
+  /// @brief Whether Snapshot() holds the data of every state, false if a
+  /// state with data is neither trivially copyable nor has Serialize(...)
+  static constexpr bool kSnapshotComplete =
+      (detail::SnapshotComplete<InitialState>::value && ... &&
+       detail::SnapshotComplete<States>::value);
+
+  /// @brief Serializes the active state and the data of all states into a
+  /// flat, versioned buffer. Trivially copyable states are copied as is,
+  /// others are written by their Serialize(...) hook or left out. Composites
+  /// are stored as their parent and children.
+  [[nodiscard]] auto Snapshot() const -> std::vector<std::byte>;
+
+  /// @brief Restores a buffer written by Snapshot() of a machine with the
+  /// same states, without calling OnEnter(...) or OnExit(...).
+  /// @return false if the buffer is from a different version or state list,
+  /// or truncated. The machine is unchanged then, except for states that
+  /// were partly read through their Deserialize(...) hook.
+  auto Restore(const std::byte *data, std::size_t size) -> bool;
+
+  auto Restore(const std::vector<std::byte> &snapshot) -> bool {
+    return Restore(snapshot.data(), snapshot.size());
+  }
+
+ private:
+  template <typename, typename>
+  friend struct TransitionTo;
+
+  /// @brief One path per leaf state, composites are flattened into their
+  /// leaves. The active leaf is the only runtime state of the hierarchy.
+  using Paths = typename detail::Concat<
+      typename detail::LeafPaths<InitialState>::type,
+      typename detail::LeafPaths<States>::type...>::type;
+
+  static constexpr std::size_t kLeaves = detail::Size<Paths>::value;
+
+  using Index = detail::StateIndex<kLeaves>;
+
+  template <std::size_t I>
+  using LeafPath = detail::type_at_t<I, Paths>;
+
+  /// @brief The leaves belonging to `State`, a single one unless composite
+  template <typename State>
+  static constexpr auto kRange = detail::LeafRange<State>(Paths{});
+
+  template <typename State>
+  static constexpr bool kContains = kRange<State>.first < kLeaves;
+
+  template <typename State>
+  using HasProcess = detail::HasProcess<State>;
+
+  template <typename Event>
+  struct HasHandleFor {
+    template <typename State>
+    using Trait = detail::HasHandle<State, Event>;
+  };
+
+  /// @brief Bit `i` is set if leaf `i` or one of its composites has a
+  /// Handle(...) for `Event`.
+  template <typename Event>
+  static constexpr auto kHandlerMask =
+      detail::LeafMask<HasHandleFor<Event>::template Trait>(Paths{});
+
+  /// @brief Number of leaves that handle `Event`
+  template <typename Event>
+  static constexpr auto kHandlers = detail::CountBits(kHandlerMask<Event>);
+
+  /// @brief Whether the observer implements OnUnhandled(...) for `Event`, only
+  /// then unhandled events need to be dispatched at all.
+  template <typename Event>
+  static constexpr bool kReportsUnhandled = !std::is_same_v<
+      decltype(&Observer::template OnUnhandled<InitialState, Event>),
+      void (NoObserver::*)(const Event &)>;
+
+  /// @brief Returns the state at `Depth` on `NodePath`
+  template <std::size_t Depth, typename NodePath>
+  auto Node() -> auto & {
+    return NodeIn<Depth>(states_, NodePath{});
+  }
+
+  template <std::size_t Depth, typename Storage, typename Head,
+            typename... Tail>
+  static auto NodeIn(Storage &storage, detail::TypeList<Head, Tail...>)
+      -> auto & {
+    auto &node = std::get<Head>(storage);
+    if constexpr (Depth == 0) {
+      return node;
+    } else {
+      return NodeIn<Depth - 1>(node.children_, detail::TypeList<Tail...>{});
+    }
+  }
+
+  /// @brief Calls `visitor` with the index of the active leaf as
+  /// std::integral_constant, through a compile-time table indexed by
+  /// `current_state_`.
+  template <typename Visitor>
+  void Dispatch(Visitor &visitor);
+
+  template <std::size_t I, typename Visitor>
+  static void DispatchTo(Visitor &visitor) {
+    visitor(std::integral_constant<std::size_t, I>{});
+  }
+
+  template <typename Visitor, std::size_t... I>
+  static constexpr auto MakeDispatchTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = void (*)(Visitor &);
+    return std::array<Fn, sizeof...(I)>{&DispatchTo<I, Visitor>...};
+  }
+
+  /// @brief Causes the statemachine to transition from `From` to `To`,
+  /// `exit(state)` is called for every left and `enter(state)` for every
+  /// entered state. `args` are the event causing the transition, as const
+  /// lvalue, or the transition's payload, as rvalue.
+  template <typename From, typename To, typename ExitFn, typename EnterFn,
+            typename... Args>
+  void Transition(ExitFn &&exit, EnterFn &&enter, Args &&.../* args */);
+
+  /// @brief The transition from `From` to `To` while `Leaf` is active, all
+  /// exited and entered states are resolved at compile time.
+  template <std::size_t Leaf, typename From, typename To, typename ExitFn,
+            typename EnterFn>
+  void TransitionFrom(ExitFn &exit, EnterFn &enter);
+
+  template <std::size_t Leaf, typename From, typename To, typename ExitFn,
+            typename EnterFn, std::size_t... I>
+  static constexpr auto MakeTransitionTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = void (*)(BasicStateMachine &, ExitFn &, EnterFn &);
+    return std::array<Fn, sizeof...(I)>{
+        &TransitionVia<Leaf + I, From, To, ExitFn, EnterFn>...};
+  }
+
+  template <std::size_t Leaf, typename From, typename To, typename ExitFn,
+            typename EnterFn>
+  static void TransitionVia(BasicStateMachine &machine, ExitFn &exit,
+                            EnterFn &enter) {
+    machine.template TransitionFrom<Leaf, From, To>(exit, enter);
+  }
+
+  /// @brief Number of states on top of `Leaf` that stay active when
+  /// transitioning from `From` to `To`.
+  template <std::size_t Leaf, typename From, typename To>
+  static constexpr auto KeptDepth() -> std::size_t;
+
+  /// @brief Calls `exit` for the last `sizeof...(I)` states on `NodePath`,
+  /// innermost first.
+  template <typename NodePath, typename ExitFn, std::size_t... I>
+  void ExitNodes(ExitFn &exit, std::index_sequence<I...> /* indices */) {
+    constexpr auto kLeaf = detail::Size<NodePath>::value - 1;
+    (ExitNode(exit, Node<kLeaf - I, NodePath>()), ...);
+  }
+
+  /// @brief Calls `enter` for `sizeof...(I)` states on `NodePath` starting at
+  /// `First`, outermost first.
+  template <std::size_t First, typename NodePath, typename EnterFn,
+            std::size_t... I>
+  void EnterNodes(EnterFn &enter, std::index_sequence<I...> /* indices */) {
+    (EnterNode(enter, Node<First + I, NodePath>()), ...);
+  }
+
+  /// @brief Calls `exit(state)`, then cancels the timeouts of `state`.
+  template <typename ExitFn, typename State>
+  void ExitNode(ExitFn &exit, State &state) {
+    exit(state);
+    if constexpr (detail::HasTimeouts<State, BasicStateMachine>::value) {
+      state.CancelTimeouts();
+    }
+  }
+
+  /// @brief Directs the timeouts of `state` to this machine, then calls
+  /// `enter(state)`, which may arm them.
+  template <typename EnterFn, typename State>
+  void EnterNode(EnterFn &enter, State &state) {
+    if constexpr (detail::HasTimeouts<State, BasicStateMachine>::value) {
+      state.BindTimeouts(*this);
+    }
+    enter(state);
+  }
+
+  /// @brief Forwards the event to the active `Leaf` or, if it has no
+  /// Handle(...) for it, to its closest composite that has.
+  template <std::size_t Leaf, typename Event>
+  void HandleIn(Event &&event);
+
+  /// @brief Forwards events from `first` while `Leaf` is active,
+  /// `handle(leaf, event)` is called for each.
+  /// @return The number of forwarded events
+  template <std::size_t Leaf, typename Event, typename HandleOne>
+  auto HandleWhileActive(const Event *first, std::size_t n, HandleOne &handle)
+      -> std::size_t;
+
+  /// @brief Writes `state`, composites as their parent and children.
+  template <typename State>
+  static void SaveState(SnapshotWriter &writer, const State &state);
+
+  /// @brief Reads what SaveState(...) wrote into `state`.
+  template <typename State>
+  static void LoadState(SnapshotReader &reader, State &state);
+
+  /// @brief The list of states the statemachine holds, no duplicates possible
+  std::tuple<InitialState, States...> states_;
+
+  /// @brief Index of the currently active leaf state within `Paths`
+  Index current_state_{0};
+};
+
+/// @brief The default state machine, reports transitions between named states
+/// to an optional log callback.
+template <typename InitialState, typename... States>
+class StateMachine
+    : public BasicStateMachine<LogCallbackObserver, InitialState, States...> {
+ public:
+  using LogCallback = LogCallbackObserver::LogCallback;
+
+  /// @brief Constructs a new state machine.
+  /// @param initial_state  The initial state the state machine begins in.
+  /// @param states         The remaining states the state machine can
+  /// transition to.
+  explicit StateMachine(InitialState initial_state, States... states)
+      : BasicStateMachine<LogCallbackObserver, InitialState, States...>{
+            LogCallbackObserver{}, std::move(initial_state),
+            std::move(states)...} {}
+
+  /// @brief Sets an optional log callback that is called for every transition
+  /// @param log_cb The callback to use, syntax should take (from, to)
+  void SetLogCallback(LogCallback log_cb) {
+    this->GetObserver().SetLogCallback(std::move(log_cb));
+  }
+};
+
+/// @brief Defines a transition to a state, moves the statemachine to the state
+/// if executed.
+/// @tparam ToState     The state the transition targets
+template <typename ToState>
+struct TransitionTo<ToState, void> {
+  /// @brief Executes this transition, an rvalue `event` is forwarded to
+  /// OnEnter(...) of the target.
+  template <typename StateMachine, typename FromState, typename... Event>
+  void Execute(StateMachine &machine, FromState &from, Event &&...event);
+};
+
+/// @brief A transition carrying data for the target state, which is moved
+/// into `ToState::OnEnter(Payload&&)` instead of the event. State machines
+/// that construct their states, see BasicVariantStateMachine, may construct
+/// the target from it instead. Either is checked at compile time.
+/// @tparam ToState     The state the transition targets
+/// @tparam Payload     The data handed to the target
+template <typename ToState, typename Payload>
+struct TransitionTo {
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  TransitionTo(Payload payload) : payload_{std::move(payload)} {}
+
+  /// @brief Executes this transition, moving the payload into the target
+  template <typename StateMachine, typename FromState, typename... Event>
+  void Execute(StateMachine &machine, FromState &from, Event &&...event);
+
+ private:
+  Payload payload_;
+};
+
+/// @brief Convenience transition that does nothing.
+struct DoNothing {
+  template <typename... Parameters>
+  void Execute(Parameters &&.../* p */) const {}
+};
+
+template <typename... Transitions>
+struct Either;
+
+template <typename... Transitions>
+struct Maybe;
+
+namespace detail {
+
+/// @brief The plain transitions `T` can be, nested Either and Maybe are
+/// flattened into their alternatives.
+template <typename T>
+struct Alternatives {
+  using type = TypeList<T>;
+};
+
+template <typename... Ts>
+struct Alternatives<Either<Ts...>>
+    : Concat<typename Alternatives<Ts>::type...> {};
+
+template <typename... Ts>
+struct Alternatives<Maybe<Ts...>> : Alternatives<Either<Ts..., DoNothing>> {};
+
+/// @brief Appends the types of `Ts...` not yet in `Seen`, keeping the order.
+template <typename Seen, typename... Ts>
+struct Unique {
+  using type = Seen;
+};
+
+template <typename... Seen, typename T, typename... Ts>
+struct Unique<TypeList<Seen...>, T, Ts...>
+    : Unique<std::conditional_t<(std::is_same_v<T, Seen> || ...),
+                                TypeList<Seen...>, TypeList<Seen..., T>>,
+             Ts...> {};
+
+template <typename List>
+struct Canonical;
+
+/// @brief The alternatives without duplicates, DoNothing first if present.
+template <typename... Ts>
+struct Canonical<TypeList<Ts...>>
+    : Unique<std::conditional_t<(std::is_same_v<Ts, DoNothing> || ...),
+                                TypeList<DoNothing>, TypeList<>>,
+             Ts...> {};
+
+/// @brief Position of `T` in `List`, the size of `List` if not contained.
+template <typename T, typename List>
+struct IndexIn;
+
+template <typename T, typename... Ts>
+struct IndexIn<T, TypeList<Ts...>> : IndexOf<T, Ts...> {};
+
+template <typename T>
+struct IsEither : std::false_type {};
+
+template <typename... Ts>
+struct IsEither<Either<Ts...>> : std::true_type {};
+
+template <typename... Ts>
+struct IsEither<Maybe<Ts...>> : std::true_type {};
+
+/// @brief How Either stores its alternatives. Transitions without data are
+/// recreated when executed, so only the index is kept.
+template <typename List>
+struct EitherStorage;
+
+template <typename... Ts>
+struct EitherStorage<TypeList<Ts...>> {
+  static constexpr bool kIndexOnly =
+      ((std::is_empty_v<Ts> && std::is_default_constructible_v<Ts>) && ...);
+
+  using type = std::conditional_t<kIndexOnly, StateIndex<sizeof...(Ts)>,
+                                  std::variant<Ts...>>;
+};
+
+}  // namespace detail
+
+/// @brief Convenience transition that can contain different transitions for
+/// branching. Nested Either and Maybe are flattened and duplicates merged at
+/// compile time, so any nesting executes through a single discriminant. If
+/// no alternative holds data that discriminant is all that is stored.
+/// @tparam ...Transitions  The transitions that can be contained
+template <typename... Transitions>
+struct Either {
+  template <typename Transition>
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  Either(Transition transition)
+      : storage_{MakeStorage(std::move(transition))} {}
+
+  template <typename StateMachine, typename FromState, typename... Event>
+  void Execute(StateMachine &machine, FromState &from, Event &&...event);
+
+ private:
+  template <typename...>
+  friend struct Either;
+
+  using Flat = typename detail::Canonical<typename detail::Concat<
+      typename detail::Alternatives<Transitions>::type...>::type>::type;
+  using Storage = typename detail::EitherStorage<Flat>::type;
+
+  static constexpr std::size_t kSize = detail::Size<Flat>::value;
+  static constexpr bool kIndexOnly = detail::EitherStorage<Flat>::kIndexOnly;
+  static constexpr bool kHasDoNothing =
+      detail::IndexIn<DoNothing, Flat>::value == 0;
+
+  template <typename Transition>
+  static auto MakeStorage(Transition &&transition) -> Storage;
+
+  /// @brief Converts the alternative at `I` of the nested `Inner`.
+  template <typename Inner, std::size_t I>
+  static auto ConvertFrom(Inner &&inner) -> Storage;
+
+  template <typename Inner, std::size_t... I>
+  static constexpr auto MakeConvertTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = Storage (*)(Inner &&);
+    return std::array<Fn, sizeof...(I)>{&ConvertFrom<Inner, I>...};
+  }
+
+  template <typename Inner, std::size_t... I>
+  static constexpr auto MakeIndexMap(std::index_sequence<I...> /* indices */) {
+    return std::array<Storage, sizeof...(I)>{static_cast<Storage>(
+        detail::IndexIn<detail::type_at_t<I, typename Inner::Flat>,
+                        Flat>::value)...};
+  }
+
+  template <std::size_t I, typename StateMachine, typename FromState,
+            typename... Event>
+  static void ExecuteAt(Either &either, StateMachine &machine,
+                        FromState &from, Event &&...event);
+
+  template <typename StateMachine, typename FromState, typename... Event,
+            std::size_t... I>
+  static constexpr auto MakeExecuteTable(
+      std::index_sequence<I...> /* indices */) {
+    using Fn = void (*)(Either &, StateMachine &, FromState &, Event &&...);
+    return std::array<Fn, sizeof...(I)>{
+        &ExecuteAt<I, StateMachine, FromState, Event...>...};
+  }
+
+  [[nodiscard]] auto Index() const -> std::size_t {
+    if constexpr (kIndexOnly) {
+      return storage_;
+    } else {
+      return storage_.index();
+    }
+  }
+
+  /// @brief The index of the alternative, with its data if any has some
+  Storage storage_;
+};
+
+/// @brief Convenience transition that can contain different transitions or
+/// nothing.
+/// @tparam ...Transitions  The transitions that can be contained
+template <typename... Transitions>
+struct Maybe : public Either<Transitions..., DoNothing> {
+  using Either<Transitions..., DoNothing>::Either;
+};
+
+// =======================================================================
+// Implementation of LogCallbackObserver Class
+// =======================================================================
+
+template <typename From, typename To, typename... Event>
+void LogCallbackObserver::OnTransition(const Event &.../* event */) {
+  if constexpr (detail::HasName<From>::value && detail::HasName<To>::value) {
+    if (log_cb_) {
+      log_cb_(From::Name(), To::Name());
+    }
+  } else {
+    static_assert(detail::is_complete_v<From>,
+                  "FromState must be fully defined.");
+    static_assert(detail::is_complete_v<To>, "ToState must be fully defined.");
+  }
+}
+
+// =======================================================================
+// Implementation of BasicStateMachine Class
+// =======================================================================
+
+template <typename Observer, typename InitialState, typename... States>
+BasicStateMachine<Observer, InitialState, States...>::BasicStateMachine(
+    Observer observer, InitialState initial_state, States... states)
+    : Observer{std::move(observer)},
+      states_{std::forward<InitialState>(initial_state),
+              std::forward<States>(states)...} {}
+
+template <typename Observer, typename InitialState, typename... States>
+void BasicStateMachine<Observer, InitialState, States...>::InitialTransition() {
+  GetObserver().template OnInitialTransition<InitialState>();
+  using Path = LeafPath<0>;
+  auto enter = [](auto &state) {
+    if constexpr (detail::HasOnEnter<decltype(state)>::value) {
+      state.OnEnter();
+    }
+  };
+  EnterNodes<0, Path>(enter,
+                      std::make_index_sequence<detail::Size<Path>::value>{});
+}
+
+template <typename Observer, typename InitialState, typename... States>
+void BasicStateMachine<Observer, InitialState, States...>::Process() {
+  auto state_visitor = [this](auto leaf) {
+    using Path = LeafPath<decltype(leaf)::value>;
+    constexpr auto kDepth = detail::DeepestWith<HasProcess>(Path{});
+    if constexpr (kDepth < detail::Size<Path>::value) {
+      auto &state = Node<kDepth, Path>();
+      VSM_PROBE2(process, this, decltype(leaf)::value);
+      state.Process().Execute(*this, state);
+    }
+  };
+  Dispatch(state_visitor);
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename Event>
+void BasicStateMachine<Observer, InitialState, States...>::Handle(
+    Event &&event) {
+  if constexpr (!kReportsUnhandled<
+                    std::remove_cv_t<std::remove_reference_t<Event>>>) {
+    if (!CanHandle<Event>()) {
+      return;
+    }
+  }
+  auto state_vistor = [this, &event](auto leaf) -> void {
+    HandleIn<decltype(leaf)::value>(std::forward<Event>(event));
+  };
+  Dispatch(state_vistor);
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename Event>
+void BasicStateMachine<Observer, InitialState, States...>::HandleBatch(
+    const Event *first, std::size_t n) {
+  if constexpr (!kReportsUnhandled<Event> &&
+                kHandlers<const Event &> == 0) {
+    return;
+  }
+  auto handle = [this](auto leaf, const Event &event) {
+    HandleIn<decltype(leaf)::value>(event);
+  };
+  std::size_t handled = 0;
+  auto batch_visitor = [this, first, n, &handled, &handle](auto leaf) {
+    constexpr auto kLeaf = decltype(leaf)::value;
+    handled += HandleWhileActive<kLeaf>(first + handled, n - handled, handle);
+  };
+  while (handled < n) {
+    Dispatch(batch_visitor);
+  }
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename... Events>
+void BasicStateMachine<Observer, InitialState, States...>::HandleBatch(
+    const std::variant<Events...> *first, std::size_t n) {
+  auto handle = [this](auto leaf, const std::variant<Events...> &event) {
+    std::visit(
+        [this](const auto &e) { HandleIn<decltype(leaf)::value>(e); }, event);
+  };
+  std::size_t handled = 0;
+  auto batch_visitor = [this, first, n, &handled, &handle](auto leaf) {
+    constexpr auto kLeaf = decltype(leaf)::value;
+    handled += HandleWhileActive<kLeaf>(first + handled, n - handled, handle);
+  };
+  while (handled < n) {
+    Dispatch(batch_visitor);
+  }
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <std::size_t Leaf, typename Event>
+void BasicStateMachine<Observer, InitialState, States...>::HandleIn(
+    Event &&event) {
+  using Path = LeafPath<Leaf>;
+  constexpr auto kDepth = detail::DeepestWith<
+      HasHandleFor<Event>::template Trait>(Path{});
+  if constexpr (kDepth < detail::Size<Path>::value) {
+    auto &state = Node<kDepth, Path>();
+    using State = std::remove_reference_t<decltype(state)>;
+    VSM_PROBE3(dispatch_begin, this, Leaf,
+               &detail::TypeTag<std::decay_t<Event>>::kTag);
+    GetObserver().template OnEventDispatched<State>(event);
+    {
+      detail::EventHandledGuard<State, std::decay_t<Event>, Observer> handled{
+          GetObserver()};
+      detail::HandleAndExecute(*this, state, std::forward<Event>(event));
+    }
+    VSM_PROBE3(dispatch_end, this, Leaf,
+               &detail::TypeTag<std::decay_t<Event>>::kTag);
+  } else {
+    using State = detail::type_at_t<kDepth - 1, Path>;
+    GetObserver().template OnUnhandled<State>(event);
+  }
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <std::size_t Leaf, typename Event, typename HandleOne>
+auto BasicStateMachine<Observer, InitialState, States...>::HandleWhileActive(
+    const Event *first, std::size_t n, HandleOne &handle) -> std::size_t {
+  std::size_t i = 0;
+  while (i < n) {
+    handle(std::integral_constant<std::size_t, Leaf>{}, first[i++]);
+    if (current_state_ != Leaf) {
+      break;
+    }
+  }
+  return i;
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename From, typename To, typename ExitFn, typename EnterFn,
+          typename... Args>
+void BasicStateMachine<Observer, InitialState, States...>::Transition(
+    ExitFn &&exit, EnterFn &&enter, Args &&.../* args */) {
+  static_assert(kContains<To>,
+                "Invalid state transition: State not part of state machine");
+  constexpr auto kFrom = kRange<From>;
+  if constexpr (kFrom.second - kFrom.first == 1) {
+    TransitionFrom<kFrom.first, From, To>(exit, enter);
+  } else {
+    // A composite handled the event, which of its leaves is left is only
+    // known at runtime.
+    using Exit = std::remove_reference_t<ExitFn>;
+    using Enter = std::remove_reference_t<EnterFn>;
+    static constexpr auto kTable =
+        MakeTransitionTable<kFrom.first, From, To, Exit, Enter>(
+            std::make_index_sequence<kFrom.second - kFrom.first>{});
+    kTable[current_state_ - kFrom.first](*this, exit, enter);
+  }
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <std::size_t Leaf, typename From, typename To, typename ExitFn,
+          typename EnterFn>
+void BasicStateMachine<Observer, InitialState, States...>::TransitionFrom(
+    ExitFn &exit, EnterFn &enter) {
+  using FromPath = LeafPath<Leaf>;
+  using ToPath = LeafPath<kRange<To>.first>;
+  constexpr auto kKept = KeptDepth<Leaf, From, To>();
+  constexpr auto kTo = kRange<To>.first;
+  VSM_PROBE3(transition_exit, this, Leaf, kTo);
+  ExitNodes<FromPath>(
+      exit, std::make_index_sequence<detail::Size<FromPath>::value - kKept>{});
+  current_state_ = static_cast<Index>(kTo);
+  EnterNodes<kKept, ToPath>(
+      enter, std::make_index_sequence<detail::Size<ToPath>::value - kKept>{});
+  VSM_PROBE3(transition_enter, this, Leaf, kTo);
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <std::size_t Leaf, typename From, typename To>
+constexpr auto BasicStateMachine<Observer, InitialState, States...>::KeptDepth()
+    -> std::size_t {
+  // States above both `From` and `To` stay active, `From` and `To` themselves
+  // are always left and entered, even if one contains the other.
+  using FromPath = LeafPath<Leaf>;
+  using ToPath = LeafPath<kRange<To>.first>;
+  auto kept = detail::CommonPrefix<FromPath, ToPath>::value;
+  kept = std::min(kept, detail::DepthOf<From>(FromPath{}));
+  return std::min(kept, detail::DepthOf<To>(ToPath{}));
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename Visitor>
+void BasicStateMachine<Observer, InitialState, States...>::Dispatch(
+    Visitor &visitor) {
+  static constexpr auto kTable =
+      MakeDispatchTable<Visitor>(std::make_index_sequence<kLeaves>{});
+  kTable[current_state_](visitor);
+}
+
+template <typename Observer, typename InitialState, typename... States>
+auto BasicStateMachine<Observer, InitialState, States...>::Snapshot() const
+    -> std::vector<std::byte> {
+  std::vector<std::byte> buffer;
+  SnapshotWriter writer{buffer};
+  writer.Write(detail::kSnapshotMagic);
+  writer.Write(kSnapshotVersion);
+  writer.Write(kSnapshotHash);
+  writer.Write(static_cast<std::uint32_t>(current_state_));
+  std::apply(
+      [&writer](const auto &...state) { (SaveState(writer, state), ...); },
+      states_);
+  return buffer;
+}
+
+template <typename Observer, typename InitialState, typename... States>
+auto BasicStateMachine<Observer, InitialState, States...>::Restore(
+    const std::byte *data, std::size_t size) -> bool {
+  SnapshotReader reader{data, size};
+  std::array<char, 4> magic{};
+  std::uint32_t version = 0;
+  std::uint64_t hash = 0;
+  std::uint32_t current = 0;
+  if (!reader.Read(magic) || magic != detail::kSnapshotMagic ||
+      !reader.Read(version) || version != kSnapshotVersion ||
+      !reader.Read(hash) || hash != kSnapshotHash || !reader.Read(current) ||
+      current >= kLeaves) {
+    return false;
+  }
+  // Without Serialize(...) hooks the size is known, check it before
+  // anything is overwritten.
+  constexpr auto kSize =
+      detail::SnapshotSize<detail::TypeList<InitialState, States...>>::value;
+  if constexpr (kSize.has_value()) {
+    if (reader.Remaining() != *kSize) {
+      return false;
+    }
+  }
+  std::apply([&reader](auto &...state) { (LoadState(reader, state), ...); },
+             states_);
+  if (!reader.Ok()) {
+    return false;
+  }
+  current_state_ = static_cast<Index>(current);
+  return true;
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename State>
+void BasicStateMachine<Observer, InitialState, States...>::SaveState(
+    SnapshotWriter &writer, const State &state) {
+  if constexpr (detail::IsComposite<State>::value) {
+    SaveState(writer,
+              static_cast<const typename State::ParentState &>(state));
+    std::apply(
+        [&writer](const auto &...child) { (SaveState(writer, child), ...); },
+        state.children_);
+  } else if constexpr (detail::kSnapshotMode<State> == 2) {
+    state.Serialize(writer);
+  } else if constexpr (detail::kSnapshotMode<State> == 1) {
+    writer.Write(state);
+  }
+}
+
+template <typename Observer, typename InitialState, typename... States>
+template <typename State>
+void BasicStateMachine<Observer, InitialState, States...>::LoadState(
+    SnapshotReader &reader, State &state) {
+  if constexpr (detail::IsComposite<State>::value) {
+    LoadState(reader, static_cast<typename State::ParentState &>(state));
+    std::apply([&reader](auto &...child) { (LoadState(reader, child), ...); },
+               state.children_);
+  } else if constexpr (detail::kSnapshotMode<State> == 2) {
+    state.Deserialize(reader);
+  } else if constexpr (detail::kSnapshotMode<State> == 1) {
+    // Assigned rather than copied over, a parent of a composite must not
+    // touch the bytes of its children.
+    alignas(State) std::byte raw[sizeof(State)];
+    if (reader.Read(raw, sizeof(State))) {
+      state = *std::launder(reinterpret_cast<const State *>(raw));
+    }
+  }
+}
+
+// =======================================================================
+// Implementation of TransitionTo Class
+// =======================================================================
+template <typename ToState>
+template <typename StateMachine, typename FromState, typename... Event>
+void TransitionTo<ToState, void>::Execute(StateMachine &machine,
+                                          FromState & /* from */,
+                                          Event &&...event) {
+  machine.GetObserver().template OnTransition<FromState, ToState>(event...);
+  machine.template Transition<FromState, ToState>(
+      [&event...](auto &state) {
+        detail::ExitState(state, std::as_const(event)...);
+      },
+      [&event...](auto &state) {
+        // Only the target may take the event, composites entered on the way
+        // see it as const.
+        using State = std::remove_reference_t<decltype(state)>;
+        if constexpr (detail::Matches<State, ToState>::value) {
+          detail::EnterState(state, std::forward<Event>(event)...);
+        } else {
+          detail::EnterState(state, std::as_const(event)...);
+        }
+      },
+      std::as_const(event)...);
+}
+
+template <typename ToState, typename Payload>
+template <typename StateMachine, typename FromState, typename... Event>
+void TransitionTo<ToState, Payload>::Execute(StateMachine &machine,
+                                             FromState & /* from */,
+                                             Event &&...event) {
+  static_assert(
+      detail::HasOnEnter<ToState, Payload &&>::value ||
+          (detail::ConstructsStates<StateMachine>::value &&
+           std::is_constructible_v<ToState, Payload &&>),
+      "Target state must accept the payload in OnEnter(Payload&&)");
+  machine.GetObserver().template OnTransition<FromState, ToState>(event...);
+  machine.template Transition<FromState, ToState>(
+      [&event...](auto &state) {
+        detail::ExitState(state, std::as_const(event)...);
+      },
+      [this](auto &state) {
+        using State = std::remove_reference_t<decltype(state)>;
+        if constexpr (detail::Matches<State, ToState>::value &&
+                      detail::HasOnEnter<State, Payload &&>::value) {
+          state.OnEnter(std::move(payload_));
+        } else {
+          detail::EnterState(state);
+        }
+      },
+      std::move(payload_));
+}
+
+// =======================================================================
+// Implementation of Either Class
+// =======================================================================
+
+template <typename... Transitions>
+template <typename Transition>
+auto Either<Transitions...>::MakeStorage(Transition &&transition) -> Storage {
+  using T = std::decay_t<Transition>;
+  constexpr auto kIndex = detail::IndexIn<T, Flat>::value;
+  if constexpr (detail::IsEither<T>::value) {
+    constexpr auto kInner = std::make_index_sequence<T::kSize>{};
+    if constexpr (kIndexOnly && T::kIndexOnly) {
+      static constexpr auto kMap = MakeIndexMap<T>(kInner);
+      return kMap[transition.Index()];
+    } else {
+      static constexpr auto kTable = MakeConvertTable<T>(kInner);
+      return kTable[transition.Index()](std::move(transition));
+    }
+  } else if constexpr (kIndexOnly) {
+    static_assert(kIndex < kSize, "Transition not part of Either");
+    return static_cast<Storage>(kIndex);
+  } else if constexpr (kIndex < kSize) {
+    return Storage{std::in_place_index<kIndex>,
+                   std::forward<Transition>(transition)};
+  } else {
+    return Storage{std::forward<Transition>(transition)};
+  }
+}
+
+template <typename... Transitions>
+template <typename Inner, std::size_t I>
+auto Either<Transitions...>::ConvertFrom(Inner &&inner) -> Storage {
+  using T = detail::type_at_t<I, typename Inner::Flat>;
+  if constexpr (Inner::kIndexOnly) {
+    return MakeStorage(T{});
+  } else {
+    return MakeStorage(std::move(std::get<I>(inner.storage_)));
+  }
+}
+
+template <typename... Transitions>
+template <std::size_t I, typename StateMachine, typename FromState,
+          typename... Event>
+void Either<Transitions...>::ExecuteAt(Either &either, StateMachine &machine,
+                                       FromState &from, Event &&...event) {
+  if constexpr (kIndexOnly) {
+    detail::type_at_t<I, Flat>{}.Execute(machine, from,
+                                         std::forward<Event>(event)...);
+  } else {
+    std::get<I>(either.storage_)
+        .Execute(machine, from, std::forward<Event>(event)...);
+  }
+}
+
+template <typename... Transitions>
+template <typename StateMachine, typename FromState, typename... Event>
+void Either<Transitions...>::Execute(StateMachine &machine, FromState &from,
+                                     Event &&...event) {
+  if constexpr (kHasDoNothing) {
+    if (Index() == 0) {
+      return;
+    }
+  }
+  if constexpr (kSize == 1 + kHasDoNothing) {
+    ExecuteAt<kSize - 1>(*this, machine, from, std::forward<Event>(event)...);
+  } else {
+    static constexpr auto kTable =
+        MakeExecuteTable<StateMachine, FromState, Event...>(
+            std::make_index_sequence<kSize>{});
+    kTable[Index()](*this, machine, from, std::forward<Event>(event)...);
+  }
+}
+
+}  // namespace vsm
+
+#endif
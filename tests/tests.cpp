@@ -1,7 +1,36 @@
+#include <sys/resource.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <cstdint>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 #include "doctest.h"
 #include "states.hpp"
+#include "vsm/executor.hpp"
+#include "vsm/journal.hpp"
+#include "vsm/latency.hpp"
+#include "vsm/mapped_pool.hpp"
+#include "vsm/metrics.hpp"
+#include "vsm/pool.hpp"
+#include "vsm/queue.hpp"
+#include "vsm/regions.hpp"
+#include "vsm/replay.hpp"
+#include "vsm/timer.hpp"
+#include "vsm/trace.hpp"
+#include "vsm/variant_machine.hpp"
 #include "vsm/vsm.hpp"
 
 namespace test_constants {
@@ -329,4 +358,2541 @@ TEST_CASE_FIXTURE(StateMachineFixture, "Test forward declarations") {
   CHECK(from == test_constants::kStateBName);
   CHECK(to == test_constants::kStateAName);
   CHECK(data == expected);
-}
\ No newline at end of file
+}
+
+TEST_SUITE("State Index") {
+  TEST_CASE("Smallest index type") {
+    CHECK(std::is_same_v<vsm::detail::StateIndex<1>, std::uint8_t>);
+    CHECK(std::is_same_v<vsm::detail::StateIndex<256>, std::uint8_t>);
+    CHECK(std::is_same_v<vsm::detail::StateIndex<257>, std::uint16_t>);
+    CHECK(std::is_same_v<vsm::detail::StateIndex<65537>, std::uint32_t>);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "IsInState after transitions") {
+    auto sm = vsm::StateMachine(test2::StateA{data}, test2::StateB{data});
+
+    CHECK(sm.IsInState<test2::StateA>());
+    CHECK_FALSE(sm.IsInState<test2::StateB>());
+
+    sm.Handle(Event{});
+    sm.Handle(Event{});
+
+    CHECK_FALSE(sm.IsInState<test2::StateA>());
+    CHECK(sm.IsInState<test2::StateB>());
+  }
+}
+
+TEST_SUITE("Observer") {
+  struct OtherEvent {};
+
+  struct CountingObserver : vsm::NoObserver {
+    template <typename From, typename To, typename... Event>
+    void OnTransition(const Event &.../* event */) {
+      transitions++;
+    }
+
+    template <typename State, typename Event>
+    void OnEventDispatched(const Event & /* event */) {
+      dispatched++;
+    }
+
+    template <typename State, typename Event>
+    void OnUnhandled(const Event & /* event */) {
+      unhandled++;
+    }
+
+    int transitions = 0;
+    int dispatched = 0;
+    int unhandled = 0;
+  };
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Hooks called") {
+    auto sm = vsm::BasicStateMachine(CountingObserver{}, test2::StateA{data},
+                                     test2::StateB{data});
+
+    sm.Handle(Event{});
+    sm.Handle(Event{});
+    sm.Handle(OtherEvent{});
+
+    CHECK(sm.IsInState<test2::StateB>());
+    CHECK(sm.GetObserver().dispatched == 2);
+    CHECK(sm.GetObserver().transitions == 1);
+    CHECK(sm.GetObserver().unhandled == 1);
+
+    sm.Process();
+    sm.Process();
+
+    CHECK(sm.IsInState<test2::StateA>());
+    CHECK(sm.GetObserver().dispatched == 2);
+    CHECK(sm.GetObserver().transitions == 2);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "No observer has no overhead") {
+    using Observed = vsm::BasicStateMachine<vsm::NoObserver, test2::StateA,
+                                            test2::StateB>;
+    using Logging = vsm::StateMachine<test2::StateA, test2::StateB>;
+
+    CHECK(sizeof(Observed) < sizeof(Logging));
+    CHECK(sizeof(Logging) - sizeof(Observed) >=
+          sizeof(vsm::LogCallbackObserver::LogCallback));
+  }
+}
+
+TEST_SUITE("Optional Handle") {
+  struct Rare {};
+  struct Never {};
+
+  struct Receiver;
+
+  struct Sender {
+    auto Handle(const Event & /* event */) -> vsm::TransitionTo<Receiver> {
+      return {};
+    }
+  };
+
+  struct Receiver {
+    int received{0};
+    auto Handle(const Event & /* event */) -> vsm::TransitionTo<Sender> {
+      return {};
+    }
+    auto Handle(const Rare & /* event */) -> vsm::DoNothing {
+      ++received;
+      return {};
+    }
+  };
+
+  struct Dispatched : vsm::NoObserver {
+    int count{0};
+    template <typename State, typename Event>
+    void OnEventDispatched(const Event & /* event */) {
+      ++count;
+    }
+  };
+
+  TEST_CASE("Can handle") {
+    auto sm = vsm::StateMachine(Sender{}, Receiver{});
+
+    CHECK(sm.CanHandle<Event>());
+    CHECK_FALSE(sm.CanHandle<Rare>());
+    CHECK_FALSE(sm.CanHandle<Never>());
+
+    sm.Handle(Event{});
+
+    CHECK(sm.CanHandle<Event>());
+    CHECK(sm.CanHandle<Rare>());
+    CHECK_FALSE(sm.CanHandle<Never>());
+  }
+
+  TEST_CASE("Unhandled events are skipped") {
+    auto sm = vsm::BasicStateMachine(Dispatched{}, Sender{}, Receiver{});
+
+    sm.Handle(Rare{});
+    sm.Handle(Never{});
+    const Rare batch[] = {Rare{}, Rare{}};
+    sm.HandleBatch(batch, 2);
+    CHECK(sm.GetObserver().count == 0);
+    CHECK(sm.IsInState<Sender>());
+
+    sm.Handle(Event{});
+    sm.Handle(Rare{});
+    sm.HandleBatch(batch, 2);
+    CHECK(sm.GetObserver().count == 4);
+    CHECK(sm.GetState<Receiver>().received == 3);
+  }
+
+  TEST_CASE("Composites can handle for their children") {
+    struct Parent {
+      auto Handle(const Rare & /* event */) -> vsm::DoNothing { return {}; }
+    };
+    auto sm = vsm::StateMachine(
+        vsm::Composite<Parent, Sender, Receiver>{Parent{}, Sender{},
+                                                 Receiver{}});
+
+    CHECK(sm.CanHandle<Rare>());
+    CHECK(sm.CanHandle<Event>());
+    CHECK_FALSE(sm.CanHandle<Never>());
+  }
+}
+
+TEST_SUITE("Event Queue") {
+  struct OtherEvent {};
+
+  using QueuedMachine =
+      vsm::Queued<vsm::StateMachine<test2::StateA, test2::StateB>, 4, Event,
+                  OtherEvent>;
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Posted events are drained") {
+    QueuedMachine sm{test2::StateA{data}, test2::StateB{data}};
+
+    CHECK(sm.Post(Event{}));
+    CHECK(sm.Post(OtherEvent{}));
+    CHECK(sm.Post(Event{}));
+
+    CHECK(data == expected);
+
+    CHECK(sm.Drain() == 3);
+
+    expected.event_handled_A += 2;
+    expected.on_exit_A_called++;
+    expected.on_enter_B_called++;
+    expected.current_state = test_constants::kStateB;
+    CHECK(data == expected);
+    CHECK(sm.IsInState<test2::StateB>());
+    CHECK(sm.Drain() == 0);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Full queue rejects events") {
+    QueuedMachine sm{test2::StateA{data}, test2::StateB{data}};
+
+    for (int i = 0; i < 4; ++i) {
+      CHECK(sm.Post(OtherEvent{}));
+    }
+    CHECK_FALSE(sm.Post(Event{}));
+
+    CHECK(sm.Drain(1) == 1);
+    CHECK(sm.Post(Event{}));
+    CHECK(sm.Drain() == 4);
+
+    expected.event_handled_A++;
+    CHECK(data == expected);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Events posted from another thread") {
+    constexpr int kEvents = 10000;
+    QueuedMachine sm{test2::StateA{data}, test2::StateB{data}};
+
+    std::thread producer([&sm] {
+      for (int i = 0; i < kEvents; ++i) {
+        while (!sm.Post(Event{})) {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    int drained = 0;
+    while (drained < kEvents) {
+      drained += static_cast<int>(sm.Drain());
+      std::this_thread::yield();
+    }
+    producer.join();
+
+    CHECK(drained == kEvents);
+    CHECK(data.event_handled_A + data.event_handled_B == kEvents);
+  }
+}
+
+TEST_SUITE("Mailbox") {
+  struct OtherEvent {};
+
+  template <vsm::Overflow kPolicy>
+  using MailboxMachine =
+      vsm::Mailbox<vsm::StateMachine<test2::StateA, test2::StateB>, 4, kPolicy,
+                   Event, OtherEvent>;
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Drop on overflow") {
+    MailboxMachine<vsm::Overflow::kDrop> sm{test2::StateA{data},
+                                            test2::StateB{data}};
+
+    for (int i = 0; i < 4; ++i) {
+      CHECK(sm.Post(OtherEvent{}));
+    }
+    CHECK_FALSE(sm.Post(Event{}));
+    CHECK(sm.Drain() == 4);
+    CHECK(data == expected);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Overwrite oldest on overflow") {
+    MailboxMachine<vsm::Overflow::kOverwriteOldest> sm{test2::StateA{data},
+                                                       test2::StateB{data}};
+
+    for (int i = 0; i < 4; ++i) {
+      CHECK(sm.Post(OtherEvent{}));
+    }
+    CHECK(sm.Post(Event{}));
+    CHECK(sm.Post(Event{}));
+    CHECK(sm.Drain() == 4);
+
+    expected.event_handled_A += 2;
+    expected.on_exit_A_called++;
+    expected.on_enter_B_called++;
+    expected.current_state = test_constants::kStateB;
+    CHECK(data == expected);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Events posted from many threads") {
+    constexpr int kProducers = 4;
+    constexpr int kEvents = 10000;
+    MailboxMachine<vsm::Overflow::kSpin> sm{test2::StateA{data},
+                                            test2::StateB{data}};
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+      producers.emplace_back([&sm] {
+        for (int i = 0; i < kEvents; ++i) {
+          sm.Post(Event{});
+        }
+      });
+    }
+
+    int drained = 0;
+    while (drained < kProducers * kEvents) {
+      drained += static_cast<int>(sm.Drain());
+      std::this_thread::yield();
+    }
+    for (auto &producer : producers) {
+      producer.join();
+    }
+
+    CHECK(data.event_handled_A + data.event_handled_B == kProducers * kEvents);
+  }
+}
+
+TEST_SUITE("Batch Handling") {
+  struct OtherEvent {};
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Batch equals single events") {
+    Data single{};
+    auto sm = vsm::StateMachine(test2::StateA{data}, test2::StateB{data});
+    auto reference =
+        vsm::StateMachine(test2::StateA{single}, test2::StateB{single});
+
+    const std::vector<Event> events(7);
+    sm.HandleBatch(events.data(), events.size());
+    for (const auto &event : events) {
+      reference.Handle(event);
+    }
+
+    CHECK(data == single);
+    CHECK(data.event_handled_A + data.event_handled_B == 7);
+    CHECK(data.on_enter_A_called + data.on_enter_B_called == 3);
+    CHECK(sm.IsInState<test2::StateB>());
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Batch of different events") {
+    using AnyEvent = std::variant<Event, OtherEvent>;
+    auto sm = vsm::StateMachine(test2::StateA{data}, test2::StateB{data});
+
+    const std::vector<AnyEvent> events{Event{}, OtherEvent{}, Event{},
+                                       OtherEvent{}, Event{}};
+    sm.HandleBatch(events.data(), events.size());
+
+    expected.event_handled_A += 2;
+    expected.on_exit_A_called++;
+    expected.on_enter_B_called++;
+    expected.event_handled_B++;
+    expected.current_state = test_constants::kStateB;
+    CHECK(data == expected);
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Empty batch") {
+    auto sm = vsm::StateMachine(test2::StateA{data}, test2::StateB{data});
+
+    sm.HandleBatch(static_cast<const Event *>(nullptr), 0);
+
+    CHECK(data == expected);
+  }
+}
+
+TEST_SUITE("State Machine Pool") {
+  struct Off;
+
+  struct On {
+    auto Handle(const Event & /* event */) -> vsm::TransitionTo<Off> {
+      return {};
+    }
+  };
+
+  struct Off {
+    auto Handle(const Event & /* event */) -> vsm::TransitionTo<On> {
+      return {};
+    }
+  };
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Instances are independent") {
+    Data other{};
+    vsm::StateMachinePool<test2::StateA, test2::StateB> pool;
+    const auto first = pool.Add(test2::StateA{data}, test2::StateB{data});
+    const auto second = pool.Add(test2::StateA{other}, test2::StateB{other});
+
+    CHECK(pool.Size() == 2);
+
+    pool.InitialTransition(first);
+    pool.Handle(first, Event{});
+    pool.Handle(first, Event{});
+
+    expected.on_enter_A_called++;
+    expected.event_handled_A += 2;
+    expected.on_exit_A_called++;
+    expected.on_enter_B_called++;
+    expected.current_state = test_constants::kStateB;
+    CHECK(data == expected);
+    CHECK(other == Data{});
+    CHECK(pool.IsInState<test2::StateB>(first));
+    CHECK(pool.IsInState<test2::StateA>(second));
+
+    pool.ProcessAll();
+    pool.ProcessAll();
+
+    expected.process_B_called += 2;
+    expected.on_exit_B_called++;
+    expected.on_enter_A_called++;
+    expected.current_state = test_constants::kStateA;
+    CHECK(data == expected);
+    CHECK(other.process_A_called == 2);
+    CHECK(pool.IsInState<test2::StateA>(first));
+    CHECK(pool.IsInState<test2::StateB>(second));
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Process all grouped by state") {
+    std::vector<Data> datas(5);
+    vsm::StateMachinePool<test2::StateA, test2::StateB> pool;
+    for (auto &d : datas) {
+      pool.Add(test2::StateA{d}, test2::StateB{d});
+    }
+    pool.Handle(1, Event{});
+    pool.Handle(1, Event{});
+    pool.Handle(3, Event{});
+    pool.Handle(3, Event{});
+
+    for (int i = 0; i < 6; ++i) {
+      pool.ProcessAll();
+    }
+
+    for (const auto &d : datas) {
+      CHECK(d.process_A_called + d.process_B_called == 6);
+    }
+    CHECK(datas[0].on_enter_B_called == 2);
+    CHECK(datas[0].on_enter_A_called == 1);
+    CHECK(datas[1].on_enter_A_called == 2);
+    CHECK(pool.IsInState<test2::StateB>(0));
+    CHECK(pool.IsInState<test2::StateA>(1));
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Process all skips passive states") {
+    vsm::StateMachinePool<no_process::StateA, no_process::StateB> pool{
+        3, no_process::StateA{data}, no_process::StateB{data}};
+
+    pool.Handle(0, Event{});
+    pool.ProcessAll();
+    pool.Handle(0, Event{});
+
+    CHECK(pool.IsInState<no_process::StateA>(0));
+    CHECK(pool.IsInState<no_process::StateA>(1));
+    CHECK(data == expected);
+  }
+
+  TEST_CASE("Pool of stateless states") {
+    vsm::StateMachinePool<Off, On> pool{1000, Off{}, On{}};
+
+    pool.Handle(1, Event{});
+    pool.Handle(2, Event{});
+    pool.Handle(2, Event{});
+
+    CHECK(pool.Size() == 1000);
+    CHECK(pool.IsInState<Off>(0));
+    CHECK(pool.IsInState<On>(1));
+    CHECK(pool.IsInState<Off>(2));
+  }
+
+  TEST_CASE("Initial transition without OnEnter") {
+    vsm::StateMachinePool<Off, On> pool{2, Off{}, On{}};
+
+    pool.InitialTransition(0);
+    pool.Handle(0, Event{});
+
+    CHECK(pool.IsInState<On>(0));
+    CHECK(pool.IsInState<Off>(1));
+  }
+}
+
+TEST_SUITE("Pool Membership") {
+  struct Go {};
+
+  struct Relaying;
+  struct Done;
+
+  struct Starting {
+    auto Process() -> vsm::TransitionTo<Relaying> {
+      processed++;
+      return {};
+    }
+    int processed = 0;
+  };
+
+  struct Relaying {
+    void OnEnter() {
+      if (relay) {
+        relay();
+      }
+    }
+    auto Handle(const Go & /* event */) -> vsm::TransitionTo<Done> {
+      return {};
+    }
+    auto Process() -> vsm::DoNothing {
+      processed++;
+      return {};
+    }
+    std::function<void()> relay;
+    int processed = 0;
+  };
+
+  struct Done {
+    auto Process() -> vsm::DoNothing {
+      processed++;
+      return {};
+    }
+    int processed = 0;
+  };
+
+  TEST_CASE("An instance moving twice during ProcessAll") {
+    using Pool = vsm::StateMachinePool<Starting, Relaying, Done>;
+    Pool pool;
+    const auto twice = pool.Add(Starting{}, Relaying{}, Done{});
+    const auto once = pool.Add(Starting{}, Relaying{}, Done{});
+    const auto waiting = pool.Add(Starting{}, Relaying{}, Done{});
+    pool.Process(waiting);
+    pool.GetState<Relaying>(twice).relay = [&pool, twice] {
+      pool.Handle(twice, Go{});
+    };
+
+    pool.ProcessAll();
+    CHECK(pool.IsInState<Done>(twice));
+    CHECK(pool.IsInState<Relaying>(once));
+    CHECK(pool.IsInState<Relaying>(waiting));
+
+    pool.ProcessAll();
+    CHECK(pool.GetState<Done>(twice).processed == 1);
+    CHECK(pool.GetState<Relaying>(once).processed == 1);
+    CHECK(pool.GetState<Relaying>(waiting).processed == 2);
+    CHECK(pool.GetState<Starting>(twice).processed == 1);
+    CHECK(pool.GetState<Starting>(once).processed == 1);
+  }
+}
+
+TEST_SUITE("Sharded Executor") {
+  TEST_CASE("Instances are processed once per tick") {
+    constexpr std::size_t kInstances = 37;
+    std::vector<Data> datas(kInstances);
+    vsm::ShardedExecutor<vsm::StateMachinePool<test2::StateA, test2::StateB>,
+                         64, Event>
+        executor{5, 3};
+    std::vector<std::size_t> ids;
+    for (auto &d : datas) {
+      ids.push_back(executor.Add(test2::StateA{d}, test2::StateB{d}));
+    }
+    CHECK(executor.Size() == kInstances);
+
+    CHECK(executor.Post(ids[3], Event{}));
+    CHECK(executor.Post(ids[3], Event{}));
+    for (int i = 0; i < 4; ++i) {
+      executor.Tick();
+    }
+
+    for (std::size_t i = 0; i < kInstances; ++i) {
+      CHECK(datas[i].process_A_called + datas[i].process_B_called == 4);
+    }
+    CHECK(datas[3].event_handled_A == 2);
+    CHECK(datas[3].on_enter_B_called == 2);
+    CHECK(datas[0].on_enter_B_called == 1);
+    CHECK(datas[0].on_enter_A_called == 1);
+    CHECK(executor.IsInState<test2::StateB>(ids[3]));
+    CHECK(executor.IsInState<test2::StateA>(ids[0]));
+  }
+}
+
+TEST_SUITE("Composite States") {
+  struct Start {};
+  struct Stop {};
+  struct Fault {};
+  struct Reset {};
+
+  using Trace = std::vector<std::string>;
+
+  struct Failed;
+  struct Running;
+
+  struct Operational {
+    Trace *trace;
+    void OnEnter() { trace->emplace_back("enter Operational"); }
+    void OnExit() { trace->emplace_back("exit Operational"); }
+    auto Handle(const Fault & /* event */) -> vsm::TransitionTo<Failed> {
+      return {};
+    }
+  };
+
+  struct Idle {
+    Trace *trace;
+    void OnEnter() { trace->emplace_back("enter Idle"); }
+    void OnExit() { trace->emplace_back("exit Idle"); }
+    auto Handle(const Start & /* event */) -> vsm::TransitionTo<Running> {
+      return {};
+    }
+  };
+
+  struct Running {
+    Trace *trace;
+    int processed{0};
+    void OnEnter() { trace->emplace_back("enter Running"); }
+    void OnExit() { trace->emplace_back("exit Running"); }
+    auto Process() -> vsm::DoNothing {
+      ++processed;
+      return {};
+    }
+    auto Handle(const Stop & /* event */) -> vsm::TransitionTo<Idle> {
+      return {};
+    }
+  };
+
+  struct Failed {
+    Trace *trace;
+    void OnEnter() { trace->emplace_back("enter Failed"); }
+    auto Handle(const Reset & /* event */) -> vsm::TransitionTo<Operational> {
+      return {};
+    }
+  };
+
+  using Machine = vsm::Composite<Operational, Idle, Running>;
+
+  TEST_CASE("Initial transition enters the initial child") {
+    Trace trace;
+    auto sm = vsm::StateMachine(
+        Machine{Operational{&trace}, Idle{&trace}, Running{&trace}},
+        Failed{&trace});
+
+    sm.InitialTransition();
+
+    CHECK(trace == Trace{"enter Operational", "enter Idle"});
+    CHECK(sm.IsInState<Idle>());
+    CHECK(sm.IsInState<Operational>());
+    CHECK(sm.IsInState<Machine>());
+    CHECK_FALSE(sm.IsInState<Failed>());
+  }
+
+  TEST_CASE("Transitions between children keep the parent active") {
+    Trace trace;
+    auto sm = vsm::StateMachine(
+        Machine{Operational{&trace}, Idle{&trace}, Running{&trace}},
+        Failed{&trace});
+
+    sm.Handle(Start{});
+    sm.Process();
+    sm.Process();
+    sm.Handle(Stop{});
+
+    CHECK(trace == Trace{"exit Idle", "enter Running", "exit Running",
+                         "enter Idle"});
+    CHECK(sm.GetState<Running>().processed == 2);
+    CHECK(sm.IsInState<Idle>());
+  }
+
+  TEST_CASE("Unhandled events bubble to the parent") {
+    Trace trace;
+    auto sm = vsm::StateMachine(
+        Machine{Operational{&trace}, Idle{&trace}, Running{&trace}},
+        Failed{&trace});
+    sm.Handle(Start{});
+    trace.clear();
+
+    sm.Handle(Fault{});
+
+    CHECK(trace == Trace{"exit Running", "exit Operational", "enter Failed"});
+    CHECK(sm.IsInState<Failed>());
+    CHECK_FALSE(sm.IsInState<Operational>());
+  }
+
+  TEST_CASE("Targeting the parent enters its initial child") {
+    Trace trace;
+    auto sm = vsm::StateMachine(
+        Machine{Operational{&trace}, Idle{&trace}, Running{&trace}},
+        Failed{&trace});
+    sm.Handle(Fault{});
+    trace.clear();
+
+    sm.Handle(Reset{});
+
+    CHECK(trace == Trace{"enter Operational", "enter Idle"});
+    CHECK(sm.IsInState<Idle>());
+  }
+
+  TEST_CASE("Nested composites") {
+    Trace trace;
+    auto sm = vsm::StateMachine(vsm::Composite<Failed, Machine>{
+        Failed{&trace},
+        Machine{Operational{&trace}, Idle{&trace}, Running{&trace}}});
+
+    sm.InitialTransition();
+    sm.Handle(Start{});
+    sm.Handle(Stop{});
+
+    CHECK(trace == Trace{"enter Failed", "enter Operational", "enter Idle",
+                         "exit Idle", "enter Running", "exit Running",
+                         "enter Idle"});
+    CHECK(sm.IsInState<Failed>());
+    CHECK(sm.IsInState<Idle>());
+  }
+}
+
+TEST_SUITE("Orthogonal Regions") {
+  struct Plugged {};
+  struct Unplugged {};
+  struct PowerToggled {};
+
+  struct LinkDown;
+  struct Standby;
+
+  struct LinkUp {
+    int processed{0};
+    auto Process() -> vsm::DoNothing {
+      ++processed;
+      return {};
+    }
+    auto Handle(const Unplugged & /* event */) -> vsm::TransitionTo<LinkDown> {
+      return {};
+    }
+  };
+
+  struct LinkDown {
+    int entered{0};
+    void OnEnter() { ++entered; }
+    auto Handle(const Plugged & /* event */) -> vsm::TransitionTo<LinkUp> {
+      return {};
+    }
+  };
+
+  struct Active {
+    int entered{0};
+    void OnEnter() { ++entered; }
+    auto Handle(const PowerToggled & /* event */)
+        -> vsm::TransitionTo<Standby> {
+      return {};
+    }
+    // Both regions react to a cable being pulled.
+    auto Handle(const Unplugged & /* event */) -> vsm::TransitionTo<Standby> {
+      return {};
+    }
+  };
+
+  struct Standby {
+    auto Handle(const PowerToggled & /* event */)
+        -> vsm::TransitionTo<Active> {
+      return {};
+    }
+  };
+
+  using Link = vsm::Region<LinkDown, LinkUp>;
+  using Power = vsm::Region<Active, Standby>;
+
+  TEST_CASE("Regions are independent") {
+    auto sm = vsm::OrthogonalStateMachine(Link{LinkDown{}, LinkUp{}},
+                                          Power{Active{}, Standby{}});
+
+    sm.InitialTransition();
+    CHECK(sm.GetState<LinkDown>().entered == 1);
+    CHECK(sm.GetState<Active>().entered == 1);
+
+    sm.Handle(Plugged{});
+    CHECK(sm.IsInState<LinkUp>());
+    CHECK(sm.IsInState<Active>());
+
+    sm.Handle(PowerToggled{});
+    CHECK(sm.IsInState<LinkUp>());
+    CHECK(sm.IsInState<Standby>());
+
+    sm.Process();
+    sm.Process();
+    CHECK(sm.GetState<LinkUp>().processed == 2);
+  }
+
+  TEST_CASE("One event reaches every region") {
+    auto sm = vsm::OrthogonalStateMachine(Link{LinkDown{}, LinkUp{}},
+                                          Power{Active{}, Standby{}});
+    sm.Handle(Plugged{});
+
+    sm.Handle(Unplugged{});
+
+    CHECK(sm.IsInState<LinkDown>());
+    CHECK(sm.IsInState<Standby>());
+    CHECK(sm.GetState<LinkDown>().entered == 1);
+  }
+
+  struct Unhandled : vsm::NoObserver {
+    int count{0};
+    template <typename State, typename Event>
+    void OnUnhandled(const Event & /* event */) {
+      ++count;
+    }
+  };
+
+  TEST_CASE("Unhandled events are reported per region") {
+    vsm::BasicOrthogonalStateMachine<Unhandled, Link, Power> sm{
+        Unhandled{}, Link{LinkDown{}, LinkUp{}}, Power{Active{}, Standby{}}};
+
+    // Only the link region knows Plugged, the power region is never asked.
+    sm.Handle(Plugged{});
+    sm.Handle(Plugged{});
+    sm.Handle(Event{});
+
+    CHECK(sm.GetObserver().count == 1);
+  }
+
+  TEST_CASE("Packed index") {
+    struct S0 {};
+    struct S1 {};
+    struct S2 {};
+    struct T0 {};
+    auto sm = vsm::OrthogonalStateMachine(vsm::Region<S0, S1, S2>{{}, {}, {}},
+                                          vsm::Region<T0>{{}});
+
+    CHECK(sm.IsInState<S0>());
+    CHECK(sm.IsInState<T0>());
+  }
+}
+
+TEST_SUITE("Variant Storage") {
+  struct Load {
+    int size;
+  };
+  struct Unload {};
+
+  struct Loaded;
+
+  struct Empty {
+    static inline int alive = 0;
+    Empty() { ++alive; }
+    Empty(const Empty & /* other */) { ++alive; }
+    Empty(Empty && /* other */) noexcept { ++alive; }
+    ~Empty() { --alive; }
+    auto operator=(const Empty &) -> Empty & = default;
+    auto operator=(Empty &&) noexcept -> Empty & = default;
+    static constexpr auto Name() { return "Empty"; }
+
+    auto Handle(const Load & /* event */) -> vsm::TransitionTo<Loaded> {
+      return {};
+    }
+  };
+
+  struct Loaded {
+    static inline int alive = 0;
+    explicit Loaded(const Load &event) : size{event.size} { ++alive; }
+    Loaded(const Loaded &other) : size{other.size} { ++alive; }
+    Loaded(Loaded &&other) noexcept : size{other.size} { ++alive; }
+    ~Loaded() { --alive; }
+    auto operator=(const Loaded &) -> Loaded & = default;
+    auto operator=(Loaded &&) noexcept -> Loaded & = default;
+    static constexpr auto Name() { return "Loaded"; }
+
+    void OnEnter(const Load & /* event */) { ++entered; }
+    auto Handle(const Unload & /* event */) -> vsm::TransitionTo<Empty> {
+      return {};
+    }
+
+    int size;
+    int entered{0};
+    std::array<char, 4096> buffer{};
+  };
+
+  TEST_CASE("Only the active state is alive") {
+    {
+      vsm::VariantStateMachine<Empty, Loaded> sm{Empty{}};
+      CHECK(Empty::alive == 1);
+      CHECK(Loaded::alive == 0);
+
+      sm.Handle(Load{42});
+      CHECK(sm.IsInState<Loaded>());
+      CHECK(Empty::alive == 0);
+      CHECK(Loaded::alive == 1);
+      CHECK(sm.GetState<Loaded>().size == 42);
+      CHECK(sm.GetState<Loaded>().entered == 1);
+      CHECK(sm.CanHandle<Unload>());
+      CHECK_FALSE(sm.CanHandle<Load>());
+
+      sm.Handle(Unload{});
+      CHECK(sm.IsInState<Empty>());
+      CHECK(Empty::alive == 1);
+      CHECK(Loaded::alive == 0);
+    }
+    CHECK(Empty::alive == 0);
+    CHECK(Loaded::alive == 0);
+  }
+
+  struct Loading;
+
+  struct Broken {
+    explicit Broken(const Load & /* event */) {
+      throw std::runtime_error{"cannot load"};
+    }
+    auto Handle(const Unload & /* event */) -> vsm::TransitionTo<Loading> {
+      return {};
+    }
+    // Not trivially copyable, so the variant cannot keep its old value.
+    std::string reason;
+  };
+
+  struct Loading {
+    auto Handle(const Load & /* event */) -> vsm::TransitionTo<Broken> {
+      return {};
+    }
+  };
+
+  TEST_CASE("A throwing constructor leaves no active state") {
+    vsm::VariantStateMachine<Loading, Broken> sm{Loading{}};
+    bool thrown = false;
+    try {
+      sm.Handle(Load{1});
+    } catch (const std::runtime_error & /* error */) {
+      thrown = true;
+    }
+    CHECK(thrown);
+    CHECK_FALSE(sm.IsInState<Loading>());
+    CHECK_FALSE(sm.IsInState<Broken>());
+    CHECK_FALSE(sm.CanHandle<Unload>());
+
+    sm.Handle(Unload{});
+    sm.Process();
+    CHECK_FALSE(sm.IsInState<Loading>());
+  }
+
+  TEST_CASE("Bounded by the largest state") {
+    using Variant =
+        vsm::BasicVariantStateMachine<vsm::NoObserver, Empty, Loaded>;
+    using Tuple = vsm::BasicStateMachine<vsm::NoObserver, Empty, Loaded>;
+    CHECK(sizeof(Variant) <= sizeof(Loaded) + alignof(Loaded));
+    CHECK(sizeof(Variant) <= sizeof(Tuple));
+  }
+
+  TEST_CASE_FIXTURE(StateMachineFixture, "Transitions are logged") {
+    vsm::VariantStateMachine<Empty, Loaded> sm{Empty{}};
+    sm.SetLogCallback(MakeLogCallback());
+
+    sm.Handle(Load{1});
+
+    CHECK(from == "Empty");
+    CHECK(to == "Loaded");
+  }
+}
+
+TEST_SUITE("Event Forwarding") {
+  struct Counted {
+    static inline int copies = 0;
+    static inline int moves = 0;
+
+    Counted() = default;
+    Counted(const Counted & /* other */) { ++copies; }
+    Counted(Counted && /* other */) noexcept { ++moves; }
+    auto operator=(const Counted & /* other */) -> Counted & {
+      ++copies;
+      return *this;
+    }
+    auto operator=(Counted && /* other */) noexcept -> Counted & {
+      ++moves;
+      return *this;
+    }
+
+    static void Reset() {
+      copies = 0;
+      moves = 0;
+    }
+  };
+
+  struct Upload {
+    Counted payload;
+  };
+  struct Keep {
+    Counted payload;
+  };
+
+  struct Storing;
+
+  struct Waiting {
+    auto Handle(const Upload & /* event */) -> vsm::TransitionTo<Storing> {
+      return {};
+    }
+    auto Handle(Keep &&event) -> vsm::DoNothing {
+      kept = std::move(event.payload);
+      return {};
+    }
+    Counted kept;
+  };
+
+  struct Storing {
+    void OnEnter(Upload &&event) { stored = std::move(event.payload); }
+    auto Handle(const Upload & /* event */)
+        -> vsm::Maybe<vsm::TransitionTo<Storing>> {
+      return vsm::TransitionTo<Storing>{};
+    }
+    Counted stored;
+  };
+
+  struct Inspecting {
+    void OnEnter(const Upload &event) { seen = &event.payload; }
+    const Counted *seen{nullptr};
+  };
+
+  struct Forwarding {
+    auto Handle(const Upload & /* event */) -> vsm::TransitionTo<Inspecting> {
+      return {};
+    }
+  };
+
+  TEST_CASE("Rvalue event is moved into the target once") {
+    auto sm = vsm::StateMachine(Waiting{}, Storing{});
+    Counted::Reset();
+
+    sm.Handle(Upload{});
+
+    CHECK(sm.IsInState<Storing>());
+    CHECK(Counted::copies == 0);
+    CHECK(Counted::moves == 1);
+  }
+
+  TEST_CASE("Rvalue event through Maybe") {
+    auto sm = vsm::StateMachine(Storing{}, Waiting{});
+    Counted::Reset();
+
+    sm.Handle(Upload{});
+
+    CHECK(Counted::copies == 0);
+    CHECK(Counted::moves == 1);
+  }
+
+  TEST_CASE("Handler takes ownership") {
+    auto sm = vsm::StateMachine(Waiting{}, Storing{});
+    Counted::Reset();
+
+    sm.Handle(Keep{});
+
+    CHECK(Counted::copies == 0);
+    CHECK(Counted::moves == 1);
+  }
+
+  struct Copying {
+    auto Handle(Upload event) -> vsm::TransitionTo<Storing> {
+      copy = std::move(event.payload);
+      return {};
+    }
+    Counted copy;
+  };
+
+  TEST_CASE("By-value handler leaves the event to the target") {
+    auto sm = vsm::StateMachine(Copying{}, Storing{});
+    Counted::Reset();
+
+    sm.Handle(Upload{});
+
+    CHECK(sm.IsInState<Storing>());
+    CHECK(Counted::copies == 1);
+    CHECK(Counted::moves == 2);
+  }
+
+  struct Blob {
+    std::vector<int> data;
+  };
+
+  struct Archived {
+    void OnEnter(Blob &&blob) { data = std::move(blob.data); }
+    std::vector<int> data;
+  };
+
+  struct Archiving {
+    auto Handle(Blob blob) -> vsm::TransitionTo<Archived> {
+      size = blob.data.size();
+      return {};
+    }
+    std::size_t size = 0;
+  };
+
+  TEST_CASE("By-value handler and target both see the payload") {
+    auto sm = vsm::StateMachine(Archiving{}, Archived{});
+
+    sm.Handle(Blob{{1, 2, 3}});
+
+    CHECK(sm.GetState<Archiving>().size == 3);
+    CHECK(sm.GetState<Archived>().data == std::vector<int>{1, 2, 3});
+  }
+
+  struct Consuming {
+    auto Handle(Upload &&event) -> vsm::TransitionTo<Storing> {
+      taken = std::move(event.payload);
+      return {};
+    }
+    Counted taken;
+  };
+
+  TEST_CASE("Consuming handler is the only one to move the event") {
+    auto sm = vsm::StateMachine(Consuming{}, Storing{});
+    Counted::Reset();
+
+    sm.Handle(Upload{});
+
+    CHECK(sm.IsInState<Storing>());
+    CHECK(Counted::copies == 0);
+    CHECK(Counted::moves == 1);
+  }
+
+  TEST_CASE("Lvalue event is never copied") {
+    auto sm = vsm::StateMachine(Forwarding{}, Inspecting{});
+    Upload upload{};
+    Counted::Reset();
+
+    sm.Handle(upload);
+
+    CHECK(sm.GetState<Inspecting>().seen == &upload.payload);
+    CHECK(Counted::copies == 0);
+    CHECK(Counted::moves == 0);
+  }
+
+  TEST_CASE("Queued events are moved out of the queue") {
+    vsm::Queued<vsm::StateMachine<Waiting, Storing>, 4, Upload> sm{Waiting{},
+                                                                  Storing{}};
+    Counted::Reset();
+
+    CHECK(sm.Post(Upload{}));
+    sm.Drain();
+
+    CHECK(sm.IsInState<Storing>());
+    CHECK(Counted::copies == 0);
+  }
+}
+
+TEST_SUITE("Transition Payload") {
+  struct Finish {};
+
+  struct Summary {
+    std::vector<int> values;
+  };
+
+  struct Reporting {
+    void OnEnter(Summary &&summary) { values = std::move(summary.values); }
+    std::vector<int> values;
+  };
+
+  struct Collecting {
+    auto Handle(const Finish & /* event */)
+        -> vsm::TransitionTo<Reporting, Summary> {
+      return Summary{std::move(values)};
+    }
+    auto Process() -> vsm::Maybe<vsm::TransitionTo<Reporting, Summary>> {
+      if (values.size() < 3) {
+        values.push_back(static_cast<int>(values.size()));
+        return vsm::DoNothing{};
+      }
+      return vsm::TransitionTo<Reporting, Summary>{Summary{std::move(values)}};
+    }
+    std::vector<int> values;
+  };
+
+  struct Constructed {
+    explicit Constructed(Summary &&summary)
+        : values{std::move(summary.values)} {}
+    std::vector<int> values;
+  };
+
+  struct Constructing {
+    auto Handle(const Finish & /* event */)
+        -> vsm::TransitionTo<Constructed, Summary> {
+      return Summary{std::move(values)};
+    }
+    std::vector<int> values;
+  };
+
+  TEST_CASE("Payload is moved into OnEnter") {
+    auto sm = vsm::StateMachine(Collecting{{1, 2, 3}}, Reporting{});
+    const auto *data = sm.GetState<Collecting>().values.data();
+
+    sm.Handle(Finish{});
+
+    CHECK(sm.IsInState<Reporting>());
+    CHECK(sm.GetState<Reporting>().values == std::vector<int>{1, 2, 3});
+    CHECK(sm.GetState<Reporting>().values.data() == data);
+  }
+
+  TEST_CASE("Payload from Process") {
+    auto sm = vsm::StateMachine(Collecting{}, Reporting{});
+
+    for (int i = 0; i < 4; ++i) {
+      sm.Process();
+    }
+
+    CHECK(sm.IsInState<Reporting>());
+    CHECK(sm.GetState<Reporting>().values == std::vector<int>{0, 1, 2});
+  }
+
+  TEST_CASE("Payload constructs the target") {
+    vsm::VariantStateMachine<Constructing, Constructed> sm{
+        Constructing{{4, 5}}};
+    const auto *data = sm.GetState<Constructing>().values.data();
+
+    sm.Handle(Finish{});
+
+    CHECK(sm.IsInState<Constructed>());
+    CHECK(sm.GetState<Constructed>().values.data() == data);
+  }
+}
+
+TEST_SUITE("Flattened Transitions") {
+  struct Step {};
+
+  struct Left {};
+  struct Right {};
+  struct Center {};
+
+  struct Loaded {
+    void OnEnter(std::vector<int> &&values) { data = std::move(values); }
+    std::vector<int> data;
+  };
+
+  struct Choosing {
+    using Branch = vsm::Either<vsm::TransitionTo<Left>,
+                               vsm::TransitionTo<Right>>;
+
+    auto Handle(const Step & /* event */)
+        -> vsm::Maybe<Branch, vsm::TransitionTo<Center>> {
+      switch (choice) {
+        case 1:
+          return Branch{vsm::TransitionTo<Left>{}};
+        case 2:
+          return Branch{vsm::TransitionTo<Right>{}};
+        case 3:
+          return vsm::TransitionTo<Center>{};
+        default:
+          return vsm::DoNothing{};
+      }
+    }
+    int choice = 0;
+  };
+
+  struct Filling {
+    auto Process() -> vsm::Maybe<vsm::Maybe<
+        vsm::TransitionTo<Loaded, std::vector<int>>>> {
+      if (values.empty()) {
+        values = {1, 2};
+        return vsm::Maybe<vsm::TransitionTo<Loaded, std::vector<int>>>{
+            vsm::DoNothing{}};
+      }
+      return vsm::TransitionTo<Loaded, std::vector<int>>{std::move(values)};
+    }
+    std::vector<int> values;
+  };
+
+  TEST_CASE("Nested Either is executed") {
+    for (int choice = 0; choice < 4; ++choice) {
+      auto sm = vsm::StateMachine(Choosing{choice}, Left{}, Right{}, Center{});
+
+      sm.Handle(Step{});
+
+      CHECK(sm.IsInState<Choosing>() == (choice == 0));
+      CHECK(sm.IsInState<Left>() == (choice == 1));
+      CHECK(sm.IsInState<Right>() == (choice == 2));
+      CHECK(sm.IsInState<Center>() == (choice == 3));
+    }
+  }
+
+  TEST_CASE("Duplicates are merged") {
+    using Twice = vsm::Maybe<vsm::TransitionTo<Left>,
+                             vsm::Maybe<vsm::TransitionTo<Left>>>;
+    using Once = vsm::Maybe<vsm::TransitionTo<Left>>;
+
+    CHECK(sizeof(Twice) == sizeof(Once));
+    CHECK(sizeof(Choosing::Branch) == 1);
+  }
+
+  TEST_CASE("Nested payload is moved") {
+    auto sm = vsm::StateMachine(Filling{}, Loaded{});
+
+    sm.Process();
+    CHECK(sm.IsInState<Filling>());
+    const auto *data = sm.GetState<Filling>().values.data();
+
+    sm.Process();
+    CHECK(sm.IsInState<Loaded>());
+    CHECK(sm.GetState<Loaded>().data == std::vector<int>{1, 2});
+    CHECK(sm.GetState<Loaded>().data.data() == data);
+  }
+}
+
+TEST_SUITE("Trace") {
+  struct Toggle {
+    static constexpr auto Name() { return "Toggle"; }
+  };
+
+  struct Off;
+
+  struct On {
+    static constexpr auto Name() { return "On"; }
+    auto Handle(const Toggle & /* event */) -> vsm::TransitionTo<Off> {
+      return {};
+    }
+  };
+
+  struct Off {
+    static constexpr auto Name() { return "Off"; }
+    auto Handle(const Toggle & /* event */) -> vsm::TransitionTo<On> {
+      return {};
+    }
+  };
+
+  auto NewRecords(std::size_t skip) -> std::vector<vsm::TraceRecord> {
+    auto records = vsm::CollectTrace().records;
+    records.erase(records.begin(),
+                  records.begin() + static_cast<std::ptrdiff_t>(skip));
+    return records;
+  }
+
+  TEST_CASE("Transitions and dispatches are recorded") {
+    const auto skip = vsm::CollectTrace().records.size();
+    vsm::BasicStateMachine sm(vsm::TraceObserver{7}, Off{}, On{});
+
+    sm.Handle(Toggle{});
+    sm.Handle(Toggle{});
+
+    const auto trace = vsm::CollectTrace();
+    const auto records = NewRecords(skip);
+    REQUIRE(records.size() == 4);
+    CHECK(records[0].kind == vsm::TraceRecord::Kind::kDispatch);
+    CHECK(trace.names[records[0].from] == "Off");
+    CHECK(trace.names[records[0].event] == "Toggle");
+    CHECK(records[1].kind == vsm::TraceRecord::Kind::kTransition);
+    CHECK(trace.names[records[1].from] == "Off");
+    CHECK(trace.names[records[1].to] == "On");
+    CHECK(trace.names[records[3].to] == "Off");
+    for (const auto &record : records) {
+      CHECK(record.machine == 7);
+    }
+    CHECK(records[0].timestamp <= records[3].timestamp);
+  }
+
+  TEST_CASE("Every thread has its own ring") {
+    vsm::BasicStateMachine sm(vsm::TraceObserver{1}, Off{}, On{});
+    sm.Handle(Toggle{});
+
+    std::thread other{[] {
+      vsm::BasicStateMachine sm(vsm::TraceObserver{2}, Off{}, On{});
+      sm.Handle(Toggle{});
+    }};
+    other.join();
+
+    std::vector<std::uint32_t> main_thread;
+    std::vector<std::uint32_t> other_thread;
+    for (const auto &record : vsm::CollectTrace().records) {
+      if (record.machine == 1) {
+        main_thread.push_back(record.thread);
+      } else if (record.machine == 2) {
+        other_thread.push_back(record.thread);
+      }
+    }
+    REQUIRE(main_thread.size() == 2);
+    REQUIRE(other_thread.size() == 2);
+    CHECK(main_thread[0] != other_thread[0]);
+  }
+
+  TEST_CASE("Binary format round trip") {
+    vsm::BasicStateMachine sm(vsm::TraceObserver{3}, Off{}, On{});
+    sm.Handle(Toggle{});
+    const auto trace = vsm::CollectTrace();
+
+    std::stringstream stream;
+    vsm::WriteTrace(stream, trace);
+    vsm::Trace read;
+    REQUIRE(vsm::ReadTrace(stream, read));
+
+    CHECK(read.ticks_per_us == trace.ticks_per_us);
+    CHECK(read.names == trace.names);
+    REQUIRE(read.records.size() == trace.records.size());
+    CHECK(read.records.back().timestamp == trace.records.back().timestamp);
+    CHECK(read.records.back().to == trace.records.back().to);
+
+    std::stringstream garbage{"not a trace"};
+    CHECK_FALSE(vsm::ReadTrace(garbage, read));
+  }
+
+  TEST_CASE("A record count beyond the input is rejected") {
+    vsm::Trace trace;
+    trace.names = {"On", "Off"};
+    trace.records.resize(2);
+    std::stringstream stream;
+    vsm::WriteTrace(stream, trace);
+
+    auto bytes = stream.str();
+    const auto count = bytes.size() - 2 * sizeof(vsm::TraceRecord) - 8;
+    const std::uint64_t huge = std::uint64_t{1} << 60;
+    bytes.replace(count, sizeof(huge),
+                  reinterpret_cast<const char *>(&huge), sizeof(huge));
+    std::stringstream corrupt{bytes};
+    vsm::Trace read;
+    CHECK_FALSE(vsm::ReadTrace(corrupt, read));
+    CHECK(read.records.empty());
+  }
+
+  TEST_CASE("Collecting while another thread traces") {
+    std::atomic<bool> done{false};
+    std::thread tracer{[&done] {
+      vsm::BasicStateMachine sm(vsm::TraceObserver{9}, Off{}, On{});
+      for (int i = 0; i < 200000; ++i) {
+        sm.Handle(Toggle{});
+      }
+      done = true;
+    }};
+
+    bool whole = true;
+    bool ordered = true;
+    while (!done) {
+      std::uint64_t previous = 0;
+      for (const auto &record : vsm::CollectTrace().records) {
+        if (record.machine != 9) {
+          continue;
+        }
+        const bool dispatch =
+            record.kind == vsm::TraceRecord::Kind::kDispatch;
+        whole = whole && (dispatch == (record.from == record.to));
+        ordered = ordered && previous <= record.timestamp;
+        previous = record.timestamp;
+      }
+    }
+    tracer.join();
+    CHECK(whole);
+    CHECK(ordered);
+  }
+}
+
+TEST_SUITE("Metrics") {
+  struct Next {};
+
+  struct Green;
+  struct Yellow;
+  struct Red;
+
+  struct Green {
+    auto Handle(const Next & /* event */) -> vsm::TransitionTo<Yellow> {
+      return {};
+    }
+  };
+
+  struct Yellow {
+    auto Handle(const Next & /* event */) -> vsm::TransitionTo<Red> {
+      return {};
+    }
+  };
+
+  struct Red {
+    auto Handle(const Next & /* event */) -> vsm::TransitionTo<Green> {
+      return {};
+    }
+  };
+
+  using Observer = vsm::MetricsObserver<Green, Yellow, Red>;
+  constexpr auto kGreen = Observer::kIndexOf<Green>;
+  constexpr auto kYellow = Observer::kIndexOf<Yellow>;
+  constexpr auto kRed = Observer::kIndexOf<Red>;
+
+  TEST_CASE("Transitions are counted per edge") {
+    vsm::BasicStateMachine sm(Observer{}, Green{}, Yellow{}, Red{});
+
+    for (int i = 0; i < 7; ++i) {
+      sm.Handle(Next{});
+    }
+
+    const auto metrics = sm.GetObserver().GetMetrics();
+    CHECK(metrics.transitions[kGreen][kYellow] == 3);
+    CHECK(metrics.transitions[kYellow][kRed] == 2);
+    CHECK(metrics.transitions[kRed][kGreen] == 2);
+    CHECK(metrics.transitions[kGreen][kRed] == 0);
+  }
+
+  TEST_CASE("Dwell time includes the active state") {
+    vsm::BasicStateMachine sm(Observer{}, Green{}, Yellow{}, Red{});
+    sm.Handle(Next{});
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+
+    const auto metrics = sm.GetObserver().GetMetrics();
+    CHECK(metrics.dwell[kYellow] >= std::chrono::milliseconds{2});
+    CHECK(metrics.dwell[kRed] == Observer::Clock::duration::zero());
+  }
+
+  TEST_CASE("Reset starts from zero") {
+    vsm::BasicStateMachine sm(Observer{}, Green{}, Yellow{}, Red{});
+    sm.Handle(Next{});
+
+    const auto before = sm.GetObserver().ResetMetrics();
+    const auto after = sm.GetObserver().GetMetrics();
+
+    CHECK(before.transitions[kGreen][kYellow] == 1);
+    CHECK(after.transitions[kGreen][kYellow] == 0);
+    CHECK(after.dwell[kGreen] == Observer::Clock::duration::zero());
+  }
+
+  TEST_CASE("Metrics of many machines add up") {
+    std::vector<vsm::BasicStateMachine<Observer, Green, Yellow, Red>> fleet(
+        4, {Observer{}, Green{}, Yellow{}, Red{}});
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+      for (std::size_t n = 0; n <= i; ++n) {
+        fleet[i].Handle(Next{});
+      }
+    }
+
+    Observer::Snapshot total;
+    for (auto &sm : fleet) {
+      total += sm.GetObserver().GetMetrics();
+    }
+
+    CHECK(total.transitions[kGreen][kYellow] == 5);
+    CHECK(total.transitions[kYellow][kRed] == 3);
+    CHECK(total.transitions[kRed][kGreen] == 2);
+  }
+
+  TEST_CASE("Dwell time starts with the initial transition") {
+    vsm::MeteredStateMachine sm(Green{}, Yellow{}, Red{});
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    CHECK(sm.GetObserver().GetMetrics().dwell[kGreen] ==
+          Observer::Clock::duration::zero());
+
+    sm.InitialTransition();
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    CHECK(sm.GetObserver().GetMetrics().dwell[kGreen] >=
+          std::chrono::milliseconds{2});
+  }
+
+  TEST_CASE("Composites are metered by their leaves") {
+    using Lights = vsm::Composite<Red, Green, Yellow>;
+    using Nested = vsm::MetricsObserver<Lights>;
+    static_assert(Nested::kStates == 2);
+    static_assert(Nested::kIndexOf<Lights> == Nested::kIndexOf<Green>);
+    static_assert(Nested::kIndexOf<Red> == Nested::kIndexOf<Green>);
+    const auto green = Nested::kIndexOf<Green>;
+    const auto yellow = Nested::kIndexOf<Yellow>;
+
+    const auto start = Nested::Clock::now();
+    vsm::MeteredStateMachine sm(Lights{Red{}, Green{}, Yellow{}});
+    sm.InitialTransition();
+    for (int i = 0; i < 2; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{2});
+      sm.Handle(Next{});
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    const auto metrics = sm.GetObserver().GetMetrics();
+    const auto elapsed = Nested::Clock::now() - start;
+
+    CHECK(sm.IsInState<Green>());
+    CHECK(metrics.transitions[green][yellow] == 1);
+    CHECK(metrics.transitions[yellow][green] == 1);
+    CHECK(metrics.dwell[green] >= std::chrono::milliseconds{4});
+    CHECK(metrics.dwell[yellow] >= std::chrono::milliseconds{2});
+    CHECK(metrics.dwell[green] + metrics.dwell[yellow] <= elapsed);
+  }
+}
+
+TEST_SUITE("Latency") {
+  struct Ping {
+    static constexpr auto Name() { return "Ping"; }
+  };
+
+  struct Waiting;
+
+  struct Serving {
+    static constexpr auto Name() { return "Serving"; }
+    auto Handle(const Ping & /* event */) -> vsm::TransitionTo<Waiting> {
+      return {};
+    }
+  };
+
+  struct Waiting {
+    static constexpr auto Name() { return "Waiting"; }
+    auto Handle(const Ping & /* event */) -> vsm::TransitionTo<Serving> {
+      return {};
+    }
+  };
+
+  auto Find(const std::vector<vsm::LatencyReport> &reports,
+            std::string_view state, std::string_view event = "Ping")
+      -> const vsm::LatencyReport * {
+    for (const auto &report : reports) {
+      if (report.state == state && report.event == event) {
+        return &report;
+      }
+    }
+    return nullptr;
+  }
+
+  TEST_CASE("Buckets are log-linear") {
+    using H = vsm::LatencyHistogram;
+    for (std::uint64_t value = 0; value < (std::uint64_t{1} << 60);
+         value += value / 3 + 1) {
+      const auto bucket = H::BucketOf(value);
+      CHECK(H::LowerBound(bucket) <= value);
+      CHECK(value < H::LowerBound(bucket) + H::Width(bucket));
+      CHECK(H::Width(bucket) * H::kSubBuckets <= std::max<std::uint64_t>(
+                                                     value, H::kSubBuckets));
+    }
+    CHECK(H::BucketOf(~std::uint64_t{0}) == H::kBuckets - 1);
+  }
+
+  TEST_CASE("Percentiles") {
+    vsm::LatencyHistogram histogram;
+    for (std::uint64_t value = 1; value <= 1000; ++value) {
+      histogram.Record(value);
+    }
+
+    CHECK(histogram.Count() == 1000);
+    CHECK(histogram.ValueAt(0.5) >= 484);
+    CHECK(histogram.ValueAt(0.5) <= 516);
+    CHECK(histogram.ValueAt(0.99) >= 959);
+    CHECK(histogram.ValueAt(0.99) <= 1021);
+    CHECK(vsm::LatencyHistogram{}.ValueAt(0.5) == 0);
+  }
+
+  TEST_CASE("Handle is measured per state and event") {
+    vsm::BasicStateMachine sm(vsm::LatencyObserver{}, Serving{}, Waiting{});
+    const auto previous = vsm::CollectLatencies();
+    const auto *before = Find(previous, "Serving");
+    const auto serving = before ? before->histogram.Count() : 0;
+
+    for (int i = 0; i < 5; ++i) {
+      sm.Handle(Ping{});
+    }
+
+    const auto reports = vsm::CollectLatencies();
+    REQUIRE(Find(reports, "Serving") != nullptr);
+    REQUIRE(Find(reports, "Waiting") != nullptr);
+    CHECK(Find(reports, "Serving")->histogram.Count() == serving + 3);
+    CHECK(Find(reports, "Serving")->P50() <= Find(reports, "Serving")->P999());
+  }
+
+  TEST_CASE("Threads are merged") {
+    const auto previous = vsm::CollectLatencies();
+    const auto *before = Find(previous, "Waiting");
+    const auto waiting = before ? before->histogram.Count() : 0;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; ++t) {
+      threads.emplace_back([] {
+        vsm::BasicStateMachine sm(vsm::LatencyObserver{}, Serving{},
+                                  Waiting{});
+        sm.Handle(Ping{});
+        sm.Handle(Ping{});
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    const auto reports = vsm::CollectLatencies();
+    const auto *after = Find(reports, "Waiting");
+    REQUIRE(after != nullptr);
+    CHECK(after->histogram.Count() == waiting + 3);
+  }
+
+  struct Relay {
+    static constexpr auto Name() { return "Relay"; }
+  };
+  struct Echo {
+    static constexpr auto Name() { return "Echo"; }
+  };
+
+  struct Relaying;
+
+  struct Quiet {
+    static constexpr auto Name() { return "Quiet"; }
+    auto Handle(const Relay & /* event */) -> vsm::TransitionTo<Relaying> {
+      return {};
+    }
+  };
+
+  struct Relaying {
+    static constexpr auto Name() { return "Relaying"; }
+    void OnEnter() {
+      std::this_thread::sleep_for(std::chrono::milliseconds{2});
+      relay();
+    }
+    auto Handle(const Echo & /* event */) -> vsm::DoNothing { return {}; }
+    std::function<void()> relay;
+  };
+
+  TEST_CASE("Nested events do not cut the outer one short") {
+    vsm::BasicStateMachine sm(vsm::LatencyObserver{}, Quiet{}, Relaying{});
+    sm.GetState<Relaying>().relay = [&sm] { sm.Handle(Echo{}); };
+    sm.Handle(Relay{});
+
+    const auto reports = vsm::CollectLatencies();
+    const auto *outer = Find(reports, "Quiet", "Relay");
+    const auto *inner = Find(reports, "Relaying", "Echo");
+    REQUIRE(outer != nullptr);
+    REQUIRE(inner != nullptr);
+    CHECK(outer->histogram.Count() == 1);
+    CHECK(inner->histogram.Count() == 1);
+    CHECK(outer->P50() >= std::chrono::milliseconds{1});
+  }
+
+  struct Fault {};
+
+  struct Faulty {
+    static constexpr auto Name() { return "Faulty"; }
+    auto Handle(const Fault & /* event */) -> vsm::DoNothing {
+      throw std::runtime_error{"fault"};
+    }
+    auto Handle(const Ping & /* event */) -> vsm::DoNothing { return {}; }
+  };
+
+  TEST_CASE("Events are measured after a Handle threw") {
+    vsm::BasicStateMachine sm(vsm::LatencyObserver{}, Faulty{});
+    int thrown = 0;
+    for (std::size_t i = 0; i <= vsm::LatencyObserver::kMaxDepth; ++i) {
+      try {
+        sm.Handle(Fault{});
+      } catch (const std::runtime_error & /* error */) {
+        thrown++;
+      }
+    }
+    sm.Handle(Ping{});
+
+    CHECK(thrown == static_cast<int>(vsm::LatencyObserver::kMaxDepth) + 1);
+    const auto reports = vsm::CollectLatencies();
+    const auto *ping = Find(reports, "Faulty");
+    REQUIRE(ping != nullptr);
+    CHECK(ping->histogram.Count() == 1);
+  }
+}
+
+TEST_SUITE("Snapshot") {
+  struct Tick {};
+
+  struct Counting;
+
+  struct Paused {
+    void OnEnter() { entered++; }
+    auto Handle(const Tick & /* event */) -> vsm::TransitionTo<Counting> {
+      return {};
+    }
+    int entered = 0;
+  };
+
+  struct Counting {
+    void OnExit() { exited++; }
+    auto Handle(const Tick & /* event */)
+        -> vsm::Maybe<vsm::TransitionTo<Paused>> {
+      if (++count % 3 == 0) {
+        return vsm::TransitionTo<Paused>{};
+      }
+      return vsm::DoNothing{};
+    }
+    std::uint64_t count = 0;
+    int exited = 0;
+  };
+
+  struct Recording {
+    void Serialize(vsm::SnapshotWriter &writer) const {
+      writer.Write(static_cast<std::uint32_t>(values.size()));
+      writer.Write(values.data(), values.size() * sizeof(int));
+    }
+    void Deserialize(vsm::SnapshotReader &reader) {
+      std::uint32_t size = 0;
+      if (reader.Read(size)) {
+        values.resize(size);
+        reader.Read(values.data(), size * sizeof(int));
+      }
+    }
+    std::vector<int> values;
+  };
+
+  struct Idle {};
+  struct Busy {
+    int jobs = 0;
+  };
+  struct Powered {
+    int volts = 0;
+  };
+
+  TEST_CASE("Round trip restores active state and data") {
+    auto sm = vsm::StateMachine(Paused{}, Counting{});
+    sm.Handle(Tick{});
+    sm.Handle(Tick{});
+    const auto snapshot = sm.Snapshot();
+
+    auto restored = vsm::StateMachine(Paused{}, Counting{});
+    REQUIRE(restored.Restore(snapshot));
+
+    CHECK(restored.IsInState<Counting>());
+    CHECK(restored.GetState<Counting>().count == 1);
+    CHECK(restored.GetState<Paused>().entered == 0);
+    CHECK(restored.GetState<Counting>().exited == 0);
+  }
+
+  TEST_CASE("States opt in with a hook") {
+    auto sm = vsm::StateMachine(Recording{{1, 2, 3}}, Idle{});
+    const auto snapshot = sm.Snapshot();
+
+    auto restored = vsm::StateMachine(Recording{}, Idle{});
+    REQUIRE(restored.Restore(snapshot));
+
+    CHECK(restored.GetState<Recording>().values == std::vector<int>{1, 2, 3});
+  }
+
+  TEST_CASE("Composites are restored") {
+    using Operating = vsm::Composite<Powered, Idle, Busy>;
+    auto sm = vsm::StateMachine(Operating{Powered{230}, Idle{}, Busy{4}});
+    const auto snapshot = sm.Snapshot();
+
+    auto restored = vsm::StateMachine(Operating{Powered{}, Idle{}, Busy{}});
+    REQUIRE(restored.Restore(snapshot));
+
+    CHECK(restored.GetState<Powered>().volts == 230);
+    CHECK(restored.GetState<Busy>().jobs == 4);
+  }
+
+  TEST_CASE("Mismatched snapshots are rejected") {
+    auto sm = vsm::StateMachine(Paused{}, Counting{});
+    sm.Handle(Tick{});
+    auto snapshot = sm.Snapshot();
+
+    auto other = vsm::StateMachine(Counting{}, Paused{});
+    CHECK_FALSE(other.Restore(snapshot));
+    CHECK(other.IsInState<Counting>());
+
+    auto same = vsm::StateMachine(Paused{}, Counting{});
+    snapshot.pop_back();
+    CHECK_FALSE(same.Restore(snapshot));
+    CHECK(same.IsInState<Paused>());
+    CHECK_FALSE(same.Restore(nullptr, 0));
+  }
+}
+
+TEST_SUITE("Mapped Pool") {
+  struct Charge {};
+
+  struct Full;
+
+  struct Charging {
+    auto Handle(const Charge & /* event */)
+        -> vsm::Maybe<vsm::TransitionTo<Full>> {
+      if (++percent < 100) {
+        return vsm::DoNothing{};
+      }
+      return vsm::TransitionTo<Full>{};
+    }
+    int percent = 0;
+  };
+
+  struct Full {
+    void OnEnter() { cycles++; }
+    int cycles = 0;
+  };
+
+  using Pool = vsm::MappedStateMachinePool<Charging, Full>;
+
+  struct PoolFile {
+    PoolFile() { std::remove(path.c_str()); }
+    ~PoolFile() { std::remove(path.c_str()); }
+    std::string path = "vsm_mapped_pool_test.bin";
+  };
+
+  TEST_CASE_FIXTURE(PoolFile, "Instances survive reopening") {
+    {
+      auto pool = Pool::Open(path.c_str(), {4, false});
+      REQUIRE(pool.has_value());
+      for (int i = 0; i < 3; ++i) {
+        REQUIRE(pool->Add(Charging{i * 50}, Full{}).has_value());
+      }
+      pool->Handle(1, Charge{});
+      pool->Handle(2, Charge{});
+      CHECK(pool->Sync());
+    }
+
+    auto pool = Pool::Open(path.c_str());
+    REQUIRE(pool.has_value());
+    REQUIRE(pool->Size() == 3);
+    CHECK(pool->IsInState<Charging>(0));
+    CHECK(pool->GetState<Charging>(1).percent == 51);
+    CHECK(pool->IsInState<Full>(2));
+    CHECK(pool->GetState<Full>(2).cycles == 1);
+  }
+
+  TEST_CASE_FIXTURE(PoolFile, "The file grows") {
+    auto pool = Pool::Open(path.c_str(), {2, false});
+    REQUIRE(pool.has_value());
+    for (int i = 0; i < 5; ++i) {
+      REQUIRE(pool->Add(Charging{i}, Full{}) == std::optional<std::size_t>{i});
+    }
+
+    CHECK(pool->Capacity() >= 5);
+    for (std::size_t id = 0; id < pool->Size(); ++id) {
+      CHECK(pool->GetState<Charging>(id).percent == static_cast<int>(id));
+    }
+  }
+
+  TEST_CASE_FIXTURE(PoolFile, "Other machines are rejected") {
+    REQUIRE(Pool::Open(path.c_str()).has_value());
+
+    CHECK_FALSE(
+        vsm::MappedStateMachinePool<Full, Charging>::Open(path.c_str()));
+  }
+
+  TEST_CASE_FIXTURE(PoolFile, "Invalid state indices are ignored") {
+    std::streamoff one = 0;
+    {
+      auto pool = Pool::Open(path.c_str(), {1, false});
+      REQUIRE(pool.has_value());
+      REQUIRE(pool->Add(Charging{}, Full{}).has_value());
+      CHECK(pool->Sync());
+      one = std::ifstream{path, std::ios::binary | std::ios::ate}.tellg();
+      REQUIRE(pool->Add(Charging{}, Full{}).has_value());
+      CHECK(pool->Sync());
+    }
+    REQUIRE(Pool::Open(path.c_str()).has_value());
+
+    // The second record starts where the file of one record ended, with the
+    // state index.
+    {
+      std::fstream file{path, std::ios::binary | std::ios::in | std::ios::out};
+      file.seekp(one);
+      file.put(static_cast<char>(0x7F));
+    }
+    auto pool = Pool::Open(path.c_str());
+    REQUIRE(pool.has_value());
+    pool->Handle(1, Charge{});
+    pool->ProcessAll();
+    CHECK_FALSE(pool->IsInState<Charging>(1));
+    CHECK_FALSE(pool->IsInState<Full>(1));
+    CHECK(pool->GetState<Charging>(1).percent == 0);
+    pool->Handle(0, Charge{});
+    CHECK(pool->GetState<Charging>(0).percent == 1);
+  }
+}
+
+TEST_SUITE("Record Replay") {
+  struct Deposit {
+    int amount;
+  };
+  struct Freeze {};
+  struct Comment {
+    std::string text;
+  };
+
+  struct Frozen;
+
+  struct Open {
+    auto Handle(const Deposit &deposit) -> vsm::DoNothing {
+      balance += deposit.amount;
+      return {};
+    }
+    auto Handle(const Freeze & /* event */) -> vsm::TransitionTo<Frozen> {
+      return {};
+    }
+    auto Handle(const Comment &comment) -> vsm::DoNothing {
+      comments += comment.text.empty() ? 1 : 100;
+      return {};
+    }
+    auto Process() -> vsm::DoNothing {
+      ticks++;
+      return {};
+    }
+    int balance = 0;
+    int comments = 0;
+    int ticks = 0;
+  };
+
+  struct Frozen {};
+
+  using Account = vsm::StateMachine<Open, Frozen>;
+
+  struct LogFile {
+    LogFile() { std::remove(path.c_str()); }
+    ~LogFile() { std::remove(path.c_str()); }
+    std::string path = "vsm_replay_test.log";
+  };
+
+  TEST_CASE_FIXTURE(LogFile, "Replay reproduces the recorded machine") {
+    {
+      std::ofstream log{path, std::ios::binary};
+      vsm::Recorded<Account, Deposit, Freeze, Comment> sm{log, Open{},
+                                                          Frozen{}};
+      sm.Handle(Deposit{5});
+      sm.Process();
+      sm.Handle(Comment{"not replayed"});
+      sm.Handle(Deposit{7});
+      sm.Process();
+      sm.Handle(Freeze{});
+      sm.Handle(Deposit{100});
+    }
+
+    auto replayer =
+        vsm::EventLogReplayer<Deposit, Freeze, Comment>::Open(path.c_str());
+    REQUIRE(replayer.has_value());
+    CHECK(replayer->Size() == 7);
+
+    Account sm{Open{}, Frozen{}};
+    CHECK(replayer->Replay(sm) == 7);
+    CHECK(sm.IsInState<Frozen>());
+    CHECK(sm.GetState<Open>().balance == 12);
+    CHECK(sm.GetState<Open>().ticks == 2);
+    CHECK(sm.GetState<Open>().comments == 1);
+  }
+
+  TEST_CASE_FIXTURE(LogFile, "Replay in parts") {
+    {
+      std::ofstream log{path, std::ios::binary};
+      vsm::Recorded<Account, Deposit, Freeze, Comment> sm{log, Open{},
+                                                          Frozen{}};
+      for (int i = 1; i <= 4; ++i) {
+        sm.Handle(Deposit{i});
+      }
+    }
+
+    auto replayer =
+        vsm::EventLogReplayer<Deposit, Freeze, Comment>::Open(path.c_str());
+    REQUIRE(replayer.has_value());
+    Account sm{Open{}, Frozen{}};
+    CHECK(replayer->Replay(sm, 1, 2) == 2);
+    CHECK(sm.GetState<Open>().balance == 5);
+    CHECK(replayer->Replay(sm, 3) == 1);
+    CHECK(replayer->Replay(sm, 9) == 0);
+    CHECK(sm.GetState<Open>().balance == 9);
+  }
+
+  TEST_CASE_FIXTURE(LogFile, "Batches are recorded event by event") {
+    {
+      std::ofstream log{path, std::ios::binary};
+      vsm::Recorded<Account, Deposit, Freeze, Comment> sm{log, Open{},
+                                                          Frozen{}};
+      const std::array<Deposit, 2> deposits{Deposit{1}, Deposit{2}};
+      sm.HandleBatch(deposits.data(), deposits.size());
+      const std::array<std::variant<Deposit, Freeze>, 2> mixed{Deposit{3},
+                                                               Freeze{}};
+      sm.HandleBatch(mixed.data(), mixed.size());
+    }
+
+    auto replayer =
+        vsm::EventLogReplayer<Deposit, Freeze, Comment>::Open(path.c_str());
+    REQUIRE(replayer.has_value());
+    CHECK(replayer->Size() == 4);
+
+    Account sm{Open{}, Frozen{}};
+    CHECK(replayer->Replay(sm) == 4);
+    CHECK(sm.IsInState<Frozen>());
+    CHECK(sm.GetState<Open>().balance == 6);
+  }
+
+  TEST_CASE_FIXTURE(LogFile, "Logs of other events are rejected") {
+    {
+      std::ofstream log{path, std::ios::binary};
+      vsm::Recorded<Account, Deposit, Freeze> sm{log, Open{}, Frozen{}};
+    }
+
+    CHECK_FALSE(vsm::EventLogReplayer<Deposit, Freeze, Comment>::Open(
+        path.c_str()));
+    CHECK(vsm::EventLogReplayer<Deposit, Freeze>::Open(path.c_str()));
+  }
+}
+
+TEST_SUITE("Journal") {
+  struct Deposit {
+    int amount;
+  };
+  struct Freeze {};
+
+  struct Frozen;
+
+  struct Open {
+    auto Handle(const Deposit &deposit) -> vsm::DoNothing {
+      balance += deposit.amount;
+      return {};
+    }
+    auto Handle(const Freeze & /* event */) -> vsm::TransitionTo<Frozen> {
+      return {};
+    }
+    auto Process() -> vsm::DoNothing {
+      ticks++;
+      return {};
+    }
+    int balance = 0;
+    int ticks = 0;
+  };
+
+  struct Frozen {
+    auto Handle(const Deposit &deposit) -> vsm::DoNothing {
+      rejected += deposit.amount;
+      return {};
+    }
+    int rejected = 0;
+  };
+
+  using Account =
+      vsm::Journaled<vsm::StateMachine<Open, Frozen>, Deposit, Freeze>;
+
+  struct JournalFile {
+    JournalFile() { Remove(); }
+    ~JournalFile() { Remove(); }
+
+    void Remove() const {
+      for (const auto &file : {path, path + ".snapshot", copy}) {
+        std::remove(file.c_str());
+      }
+    }
+
+    /// @brief Copies the journal as a crash at this point would leave it.
+    void Crash() const {
+      std::ifstream in{path, std::ios::binary};
+      std::ofstream out{copy, std::ios::binary};
+      out << in.rdbuf();
+    }
+
+    [[nodiscard]] auto Size() const -> std::size_t {
+      std::ifstream in{path, std::ios::binary | std::ios::ate};
+      return static_cast<std::size_t>(in.tellg());
+    }
+
+    std::string path = "vsm_journal_test.log";
+    std::string copy = "vsm_journal_test.copy";
+  };
+
+  /// @brief Makes writes past `size` bytes of any file fail while alive.
+  struct FileSizeLimit {
+    explicit FileSizeLimit(std::size_t size)
+        : handler{std::signal(SIGXFSZ, SIG_IGN)} {
+      getrlimit(RLIMIT_FSIZE, &previous);
+      rlimit limit = previous;
+      limit.rlim_cur = static_cast<rlim_t>(size);
+      setrlimit(RLIMIT_FSIZE, &limit);
+    }
+    ~FileSizeLimit() {
+      setrlimit(RLIMIT_FSIZE, &previous);
+      std::signal(SIGXFSZ, handler);
+    }
+    FileSizeLimit(const FileSizeLimit &) = delete;
+    auto operator=(const FileSizeLimit &) = delete;
+
+    void (*handler)(int);
+    rlimit previous{};
+  };
+
+  TEST_CASE_FIXTURE(JournalFile, "Reopening recovers the machine") {
+    {
+      auto sm = Account::Open(path, {}, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+      CHECK(sm->Recovered() == 0);
+      sm->Handle(Deposit{5});
+      sm->Process();
+      sm->Handle(Deposit{7});
+      sm->Handle(Freeze{});
+      sm->Handle(Deposit{100});
+      CHECK(sm->Sequence() == 5);
+    }
+
+    auto sm = Account::Open(path, {}, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 5);
+    CHECK(sm->Committed() == 5);
+    CHECK(sm->IsInState<Frozen>());
+    CHECK(sm->GetState<Open>().balance == 12);
+    CHECK(sm->GetState<Open>().ticks == 1);
+    CHECK(sm->GetState<Frozen>().rejected == 100);
+
+    sm->Handle(Deposit{1});
+    CHECK(sm->Sequence() == 6);
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Records are committed in groups") {
+    vsm::JournalOptions options;
+    options.group_events = 3;
+    options.group_window = std::chrono::hours{1};
+    auto sm = Account::Open(path, options, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+
+    sm->Handle(Deposit{1});
+    sm->Handle(Deposit{2});
+    CHECK(sm->Committed() == 0);
+    Crash();
+    sm->Handle(Deposit{3});
+    CHECK(sm->Committed() == 3);
+    sm->Handle(Deposit{4});
+    CHECK(sm->Committed() == 3);
+    CHECK(sm->Commit());
+    CHECK(sm->Committed() == 4);
+    CHECK(sm->Ok());
+
+    auto crashed = Account::Open(copy, options, Open{}, Frozen{});
+    REQUIRE(crashed.has_value());
+    CHECK(crashed->Recovered() == 0);
+    CHECK(crashed->GetState<Open>().balance == 0);
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "An expired window commits the group") {
+    vsm::JournalOptions options;
+    options.group_window = std::chrono::microseconds{0};
+    auto sm = Account::Open(path, options, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    sm->Handle(Deposit{1});
+    CHECK(sm->Committed() == 1);
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Checkpoints compact the journal") {
+    {
+      auto sm = Account::Open(path, {}, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+      const auto empty = Size();
+      sm->Handle(Deposit{5});
+      sm->Handle(Deposit{7});
+      CHECK(sm->Checkpoint());
+      CHECK(Size() == empty);
+      sm->Handle(Freeze{});
+      sm->Handle(Deposit{100});
+    }
+
+    auto sm = Account::Open(path, {}, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 2);
+    CHECK(sm->Sequence() == 4);
+    CHECK(sm->IsInState<Frozen>());
+    CHECK(sm->GetState<Open>().balance == 12);
+    CHECK(sm->GetState<Frozen>().rejected == 100);
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Checkpoints are taken automatically") {
+    vsm::JournalOptions options;
+    options.group_events = 2;
+    options.checkpoint_events = 4;
+    {
+      auto sm = Account::Open(path, options, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+      for (int i = 1; i <= 5; ++i) {
+        sm->Handle(Deposit{i});
+      }
+    }
+
+    auto sm = Account::Open(path, options, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 1);
+    CHECK(sm->GetState<Open>().balance == 15);
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "A torn record is cut off") {
+    std::size_t committed = 0;
+    {
+      auto sm = Account::Open(path, {}, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+      sm->Handle(Deposit{5});
+      sm->Handle(Deposit{7});
+      CHECK(sm->Commit());
+      committed = Size();
+    }
+    {
+      std::ofstream out{path, std::ios::binary | std::ios::app};
+      out << "torn";
+    }
+
+    {
+      auto sm = Account::Open(path, {}, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+      CHECK(sm->Recovered() == 2);
+      CHECK(Size() == committed);
+      sm->Handle(Deposit{1});
+    }
+
+    auto sm = Account::Open(path, {}, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 3);
+    CHECK(sm->GetState<Open>().balance == 13);
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Journals of other events are rejected") {
+    {
+      auto sm = Account::Open(path, {}, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+    }
+
+    using Other = vsm::Journaled<vsm::StateMachine<Open, Frozen>, Deposit>;
+    CHECK_FALSE(Other::Open(path, {}, Open{}, Frozen{}));
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Events are refused once a commit failed") {
+    vsm::JournalOptions options;
+    options.group_events = 2;
+    options.group_window = std::chrono::hours{1};
+    auto sm = Account::Open(path, options, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    sm->Handle(Deposit{1});
+    {
+      const FileSizeLimit limit{Size()};
+      sm->Handle(Deposit{2});
+    }
+    CHECK_FALSE(sm->Ok());
+    for (int i = 0; i < 5; ++i) {
+      sm->Handle(Deposit{10});
+      sm->Process();
+    }
+    CHECK(sm->Sequence() == 2);
+    CHECK(sm->Committed() == 0);
+    CHECK(sm->GetState<Open>().balance == 1);
+    CHECK(sm->GetState<Open>().ticks == 0);
+    CHECK_FALSE(sm->Commit());
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Batches are journaled event by event") {
+    {
+      auto sm = Account::Open(path, {}, Open{}, Frozen{});
+      REQUIRE(sm.has_value());
+      const std::array<Deposit, 3> deposits{Deposit{1}, Deposit{2},
+                                            Deposit{3}};
+      sm->HandleBatch(deposits.data(), deposits.size());
+      const std::array<std::variant<Deposit, Freeze>, 3> mixed{
+          Deposit{4}, Freeze{}, Deposit{100}};
+      sm->HandleBatch(mixed.data(), mixed.size());
+      CHECK(sm->Sequence() == 6);
+    }
+
+    auto sm = Account::Open(path, {}, Open{}, Frozen{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 6);
+    CHECK(sm->IsInState<Frozen>());
+    CHECK(sm->GetState<Open>().balance == 10);
+    CHECK(sm->GetState<Frozen>().rejected == 100);
+  }
+
+  struct Notes {
+    auto Handle(const Deposit &deposit) -> vsm::DoNothing {
+      text += std::to_string(deposit.amount);
+      return {};
+    }
+    std::string text;
+  };
+
+  struct SerializedNotes : Notes {
+    void Serialize(vsm::SnapshotWriter &writer) const {
+      writer.Write(static_cast<std::uint32_t>(text.size()));
+      writer.Write(text.data(), text.size());
+    }
+    void Deserialize(vsm::SnapshotReader &reader) {
+      std::uint32_t size = 0;
+      if (reader.Read(size) && size <= reader.Remaining()) {
+        text.resize(size);
+        reader.Read(text.data(), size);
+      }
+    }
+  };
+
+  TEST_CASE_FIXTURE(JournalFile, "Incomplete snapshots are not taken") {
+    using Unserialized =
+        vsm::Journaled<vsm::StateMachine<Notes>, Deposit>;
+    static_assert(!Unserialized::kSnapshotComplete);
+    {
+      auto sm = Unserialized::Open(path, {}, Notes{});
+      REQUIRE(sm.has_value());
+      sm->Handle(Deposit{1});
+      CHECK_FALSE(sm->Checkpoint());
+      sm->Handle(Deposit{2});
+    }
+
+    auto sm = Unserialized::Open(path, {}, Notes{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 2);
+    CHECK(sm->GetState<Notes>().text == "12");
+  }
+
+  TEST_CASE_FIXTURE(JournalFile, "Serialized states are checkpointed") {
+    using Serialized =
+        vsm::Journaled<vsm::StateMachine<SerializedNotes>, Deposit>;
+    static_assert(Serialized::kSnapshotComplete);
+    {
+      auto sm = Serialized::Open(path, {}, SerializedNotes{});
+      REQUIRE(sm.has_value());
+      sm->Handle(Deposit{1});
+      CHECK(sm->Checkpoint());
+      sm->Handle(Deposit{2});
+    }
+
+    auto sm = Serialized::Open(path, {}, SerializedNotes{});
+    REQUIRE(sm.has_value());
+    CHECK(sm->Recovered() == 1);
+    CHECK(sm->GetState<SerializedNotes>().text == "12");
+  }
+}
+
+TEST_SUITE("Timers") {
+  using namespace std::chrono_literals;
+
+  struct Fired {
+    static void Record(void *context) {
+      auto &fired = *static_cast<Fired *>(context);
+      fired.order.push_back(fired.next++);
+    }
+    std::vector<int> order;
+    int next = 0;
+  };
+
+  TEST_CASE("Timers fire at their tick") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    std::vector<int> fired;
+    auto record = [](void *context) {
+      static_cast<std::vector<int> *>(context)->push_back(1);
+    };
+    vsm::Timer timer;
+    timer.SetCallback(record, &fired);
+    wheel.Arm(timer, 3ms);
+    CHECK(timer.Armed());
+    CHECK(wheel.Size() == 1);
+
+    CHECK(wheel.Advance(start + 2ms) == 0);
+    CHECK(fired.empty());
+    CHECK(wheel.Advance(start + 3ms) == 1);
+    CHECK(fired.size() == 1);
+    CHECK_FALSE(timer.Armed());
+    CHECK(wheel.Size() == 0);
+  }
+
+  TEST_CASE("Delays are rounded up to a tick") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    vsm::Timer timer;
+    wheel.Arm(timer, 1500us);
+    CHECK(wheel.Advance(start + 1ms) == 0);
+    CHECK(wheel.Advance(start + 2ms) == 1);
+
+    wheel.Arm(timer, 0ms);
+    CHECK(wheel.Advance(start + 3ms) == 1);
+  }
+
+  TEST_CASE("Cancelled timers do not fire") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    vsm::Timer first;
+    vsm::Timer second;
+    wheel.Arm(first, 5ms);
+    wheel.Arm(second, 5ms);
+    first.Cancel();
+    CHECK_FALSE(first.Armed());
+    CHECK(wheel.Size() == 1);
+    CHECK(wheel.Advance(start + 10ms) == 1);
+    CHECK_FALSE(second.Armed());
+  }
+
+  TEST_CASE("Long delays cascade through the levels") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    Fired fired;
+    const std::array<std::chrono::milliseconds, 5> delays{
+        7ms, 300ms, 70'000ms, 20'000'000ms, 5'000'000'000ms};
+    std::array<vsm::Timer, delays.size()> timers;
+    for (std::size_t i = timers.size(); i-- > 0;) {
+      timers[i].SetCallback(&Fired::Record, &fired);
+      wheel.Arm(timers[i], delays[i]);
+    }
+    for (std::size_t i = 0; i < delays.size(); ++i) {
+      CHECK(wheel.Advance(start + delays[i] - 1ms) == 0);
+      CHECK(timers[i].Armed());
+      CHECK(wheel.Advance(start + delays[i]) == 1);
+      CHECK_FALSE(timers[i].Armed());
+    }
+    CHECK(fired.order == std::vector<int>{0, 1, 2, 3, 4});
+  }
+
+  TEST_CASE("Timers of one tick fire in one advance") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{10ms, start};
+    std::array<vsm::Timer, 100> timers;
+    for (std::size_t i = 0; i < timers.size(); ++i) {
+      wheel.Arm(timers[i], std::chrono::milliseconds{i % 20 + 1});
+    }
+    CHECK(wheel.Advance(start + 10ms) == 50);
+    CHECK(wheel.Advance(start + 20ms) == 50);
+  }
+
+  struct Walk {};
+  struct Blink {};
+  struct Pressed {};
+
+  struct Waiting;
+
+  struct Walking : vsm::Timeouts<Walk, Blink> {
+    using Timeouts::Timeouts;
+    void OnEnter() {
+      ArmTimeout<Walk>(10ms);
+      ArmTimeout<Blink>(1ms);
+    }
+    auto Handle(const vsm::Timeout<Blink> & /* event */) -> vsm::DoNothing {
+      blinks++;
+      ArmTimeout<Blink>(1ms);
+      return {};
+    }
+    auto Handle(const vsm::Timeout<Walk> & /* event */)
+        -> vsm::TransitionTo<Waiting> {
+      return {};
+    }
+    int blinks = 0;
+  };
+
+  struct Waiting : vsm::Timeouts<Waiting> {
+    using Timeouts::Timeouts;
+    void OnEnter() { ArmTimeout<Waiting>(5ms); }
+    auto Handle(const Pressed & /* event */) -> vsm::TransitionTo<Walking> {
+      return {};
+    }
+    auto Handle(const vsm::Timeout<Waiting> & /* event */)
+        -> vsm::TransitionTo<Walking> {
+      timeouts++;
+      return {};
+    }
+    int timeouts = 0;
+  };
+
+  TEST_CASE("Timeouts are delivered as events") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    vsm::StateMachine<Walking, Waiting> sm{Walking{wheel}, Waiting{wheel}};
+    sm.InitialTransition();
+    CHECK(wheel.Size() == 2);
+
+    wheel.Advance(start + 9ms);
+    CHECK(sm.IsInState<Walking>());
+    CHECK(sm.GetState<Walking>().blinks == 9);
+
+    wheel.Advance(start + 10ms);
+    CHECK(sm.IsInState<Waiting>());
+    CHECK_FALSE(sm.GetState<Walking>().TimeoutArmed<Blink>());
+    CHECK(wheel.Size() == 1);
+
+    wheel.Advance(start + 15ms);
+    CHECK(sm.IsInState<Walking>());
+    CHECK(sm.GetState<Waiting>().timeouts == 1);
+  }
+
+  TEST_CASE("Leaving a state cancels its timeouts") {
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    vsm::StateMachine<Waiting, Walking> sm{Waiting{wheel}, Walking{wheel}};
+    sm.InitialTransition();
+    wheel.Advance(start + 4ms);
+    sm.Handle(Pressed{});
+    CHECK(sm.IsInState<Walking>());
+    CHECK_FALSE(sm.GetState<Waiting>().TimeoutArmed<Waiting>());
+
+    wheel.Advance(start + 5ms);
+    CHECK(sm.IsInState<Walking>());
+    CHECK(sm.GetState<Waiting>().timeouts == 0);
+  }
+
+  TEST_CASE("Timeouts armed by journal recovery fire") {
+    using Crossing =
+        vsm::Journaled<vsm::StateMachine<Waiting, Walking>, Pressed>;
+    const std::string path = "vsm_timeouts_journal_test.log";
+    const auto remove = [&path] {
+      std::remove(path.c_str());
+      std::remove((path + ".snapshot").c_str());
+    };
+    remove();
+    {
+      vsm::TimerWheel wheel{1ms};
+      auto sm = Crossing::Open(path, {}, Waiting{wheel}, Walking{wheel});
+      REQUIRE(sm.has_value());
+      sm->Handle(Pressed{});
+    }
+
+    const auto start = vsm::TimerWheel::Clock::now();
+    vsm::TimerWheel wheel{1ms, start};
+    auto sm = Crossing::Open(path, {}, Waiting{wheel}, Walking{wheel});
+    REQUIRE(sm.has_value());
+    CHECK(sm->IsInState<Walking>());
+    CHECK(sm->GetState<Walking>().TimeoutArmed<Blink>());
+    wheel.Advance(start + 3ms);
+    CHECK(sm->GetState<Walking>().blinks == 3);
+    sm.reset();
+    remove();
+  }
+}
@@ -0,0 +1,140 @@
+// Decodes a binary trace written by vsm::WriteTrace into the Chrome trace
+// event format, viewable in chrome://tracing or https://ui.perfetto.dev.
+//
+//   trace_decode trace.bin > trace.json
+//
+// Every machine is shown as a process and every tracing thread as a thread.
+// The time spent in a state becomes a slice, transitions and dispatched
+// events become instant events.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "vsm/trace.hpp"
+
+namespace {
+
+auto Escape(std::string_view text) -> std::string {
+  std::string escaped;
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += ' ';
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+class ChromeTraceWriter {
+ public:
+  ChromeTraceWriter(const vsm::Trace &trace, std::ostream &out)
+      : trace_{trace}, out_{out} {}
+
+  void Write() {
+    auto records = trace_.records;
+    std::stable_sort(records.begin(), records.end(),
+                     [](const auto &lhs, const auto &rhs) {
+                       return lhs.timestamp < rhs.timestamp;
+                     });
+    if (!records.empty()) {
+      start_ = records.front().timestamp;
+    }
+
+    out_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (const auto &record : records) {
+      if (record.kind == vsm::TraceRecord::Kind::kTransition) {
+        WriteTransition(record);
+      } else {
+        WriteInstant(record, "dispatch", Name(record.event), record.from);
+      }
+    }
+    out_ << "\n]}\n";
+  }
+
+ private:
+  struct Entered {
+    std::uint64_t timestamp;
+    std::uint32_t thread;
+  };
+
+  auto Name(std::uint16_t index) const -> std::string {
+    if (index < trace_.names.size() && !trace_.names[index].empty()) {
+      return Escape(trace_.names[index]);
+    }
+    return "#" + std::to_string(index);
+  }
+
+  auto Microseconds(std::uint64_t timestamp) const -> double {
+    return static_cast<double>(timestamp - start_) / trace_.ticks_per_us;
+  }
+
+  void Separator() {
+    out_ << (first_ ? "\n" : ",\n");
+    first_ = false;
+  }
+
+  void WriteTransition(const vsm::TraceRecord &record) {
+    const auto entered = entered_.find(record.machine);
+    if (entered != entered_.end()) {
+      const auto &[timestamp, thread] = entered->second;
+      Separator();
+      out_ << "{\"name\":\"" << Name(record.from)
+           << "\",\"cat\":\"state\",\"ph\":\"X\",\"ts\":"
+           << Microseconds(timestamp)
+           << ",\"dur\":" << Microseconds(record.timestamp) -
+                                 Microseconds(timestamp)
+           << ",\"pid\":" << record.machine << ",\"tid\":" << thread << "}";
+    }
+    entered_[record.machine] = Entered{record.timestamp, record.thread};
+    WriteInstant(record, "transition",
+                 Name(record.from) + " -> " + Name(record.to), record.event);
+  }
+
+  void WriteInstant(const vsm::TraceRecord &record, std::string_view category,
+                    const std::string &name, std::uint16_t detail) {
+    Separator();
+    out_ << "{\"name\":\"" << name << "\",\"cat\":\"" << category
+         << "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+         << Microseconds(record.timestamp) << ",\"pid\":" << record.machine
+         << ",\"tid\":" << record.thread;
+    if (detail != vsm::TraceRecord::kNoEvent) {
+      out_ << ",\"args\":{\""
+           << (record.kind == vsm::TraceRecord::Kind::kTransition ? "event"
+                                                                  : "state")
+           << "\":\"" << Name(detail) << "\"}";
+    }
+    out_ << "}";
+  }
+
+  const vsm::Trace &trace_;
+  std::ostream &out_;
+  std::uint64_t start_ = 0;
+  bool first_ = true;
+  std::map<std::uint32_t, Entered> entered_;
+};
+
+}  // namespace
+
+auto main(int argc, char *argv[]) -> int {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " <trace file>\n";
+    return 1;
+  }
+  std::ifstream in{argv[1], std::ios::binary};
+  vsm::Trace trace;
+  if (!in || !vsm::ReadTrace(in, trace)) {
+    std::cerr << "could not read trace from " << argv[1] << "\n";
+    return 1;
+  }
+  ChromeTraceWriter{trace, std::cout}.Write();
+  return 0;
+}